@@ -13,15 +13,50 @@
 
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <queue>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <cerrno>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "freecell.h"
+
 #ifdef USE_CURSES
 constexpr bool kUseCurses = true;
 #include <ncurses.h>
@@ -29,7 +64,13 @@ constexpr bool kUseCurses = true;
 constexpr bool kUseCurses = false;
 #endif
 
-#define DEBUG_MODE
+// How thoroughly to check board invariants during the search. At 0, the
+// checks are compiled out entirely. At 1, a sample of generated boards is
+// checked (every 1024th by default; see --sanity). At 2, every board is
+// checked, and so are the board-copying primitives' own bookkeeping.
+#ifndef SANITY_CHECKS
+#define SANITY_CHECKS 1
+#endif
 
 using std::cerr;
 using std::cout;
@@ -114,14 +155,19 @@ struct Card {
     EMPTY, A, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE, TEN, J, Q, K
   };
   
+  static constexpr const char *kFaceNames[] = {
+    "ERR", "Ace", "Two", "Three", "Four", "Five", "Six", "Seven",
+    "Eight", "Nine", "Ten", "Jack", "Queen", "King"
+  };
+  static constexpr const char *kSuitNames[] = {
+    "Spades", "Hearts", "Diamonds", "Clubs"
+  };
+  static constexpr char kFaceChars[] = "XA23456789TJQK";
+  static constexpr char kSuitChars[] = "SHDC";
+  
   string str() const {
-    static string names[] = {
-      "ERR", "Ace", "Two", "Three", "Four", "Five", "Six", "Seven",
-      "Eight", "Nine", "Ten", "Jack", "Queen", "King"
-    };
-    static string suits[] = { "Spades", "Hearts", "Diamonds", "Clubs" };
     if (!face) return "Empty";
-    return names[face] + " of " + suits[suit];
+    return string(kFaceNames[face]) + " of " + kSuitNames[suit];
   }
   
   string chr() const {
@@ -136,7 +182,7 @@ struct Card {
   }
   
   string desc() const {
-    return face ? string(1, "XA23456789TJQK"[face]) + "SHDC"[suit] : "XX";
+    return face ? string(1, kFaceChars[face]) + kSuitChars[suit] : "XX";
   }
   
   static bool color(Card::Suit s) {
@@ -153,10 +199,46 @@ struct Card {
   
   void clear() { value = 0; }
   
+  /// Reads a face ("A", "2"-"10", "T", "J", "Q", "K", in either case), or
+  /// returns false.
+  static bool read_face(const string &desc, int *face) {
+    if (desc.empty()) return false;
+    if (std::isdigit(desc[0])) {
+      char *end;
+      *face = strtol(desc.c_str(), &end, 10);
+      return !*end && *face >= A && *face <= K;
+    }
+    const char *f = desc.length() == 1
+        ? strchr(kFaceChars, std::toupper(desc[0])) : nullptr;
+    if (!f || f == kFaceChars) return false;
+    *face = f - kFaceChars;
+    return true;
+  }
+  
+  static bool read_suit(char desc, Suit *suit) {
+    const char *s = desc ? strchr(kSuitChars, std::toupper(desc)) : nullptr;
+    if (!s) return false;
+    *suit = (Suit) (s - kSuitChars);
+    return true;
+  }
+  
+  /// Reads a card like "4H" or "10s", or returns false. Unlike the string
+  /// constructor, it doesn't abort on junk.
+  static bool read(const string &desc, Card *out) {
+    int f;
+    Suit s;
+    if (desc.length() < 2 || !read_face(desc.substr(0, desc.length() - 1), &f)
+        || !read_suit(desc.back(), &s)) {
+      return false;
+    }
+    *out = Card((Face) f, s);
+    return true;
+  }
+  
   Card(): value(0) {}
-  Card(Face f, Suit s): suit(s), face(f) {}
+  Card(Face f, Suit s): value(0) { suit = s; face = f; }
   Card(int8_t v): value(v) {}
-  Card(string desc) {
+  Card(string desc): value(0) {
     size_t i = 0;
     while (i < desc.length() && std::isspace(desc[i])) ++i;
     const size_t f = i;
@@ -220,9 +302,15 @@ struct FluffyBoard {
   Card reserve[RESERVE_SIZE] {};
   Card foundation[4] {};
   vector<FluffyCascade> cascades;
+  card_count_t cells = RESERVE_SIZE; ///< As Board::cells.
   
   string desc() const {
     string res;
+    string cells, founds;
+    for (Card c : reserve) if (c) cells += " " + c.desc();
+    for (Card c : foundation) if (c) founds += " " + c.desc();
+    if (!cells.empty()) res += "Freecells:" + cells + "\n";
+    if (!founds.empty()) res += "Foundations:" + founds + "\n";
     bool more = true;
     for (size_t i = 0; more; ++i) {
       string line = ":";
@@ -240,6 +328,27 @@ struct FluffyBoard {
     return res;
   }
   
+  /// Writes the position one cascade per line, with the foundations and free
+  /// cells in the style most other solvers read and write.
+  string columns_desc() const {
+    string res = "Foundations:";
+    for (Card::Suit s : { Card::HEART, Card::CLUB, Card::DIAMOND, Card::SPADE }) {
+      res += string(" ") + Card::kSuitChars[s] + "-"
+           + (foundation[s] ? Card::kFaceChars[foundation[s].face] : '0');
+    }
+    res += "\nFreecells:";
+    for (card_count_t i = 0; i < cells; ++i) {
+      res += " " + (reserve[i] ? reserve[i].desc() : string("-"));
+    }
+    res += "\n";
+    for (const FluffyCascade &c : cascades) {
+      res += ":";
+      for (Card card : c) res += " " + card.desc();
+      res += "\n";
+    }
+    return res;
+  }
+  
   string str() const {
     string res;
     for (size_t i = 0; i < RESERVE_SIZE; ++i) {
@@ -270,54 +379,8 @@ struct FluffyBoard {
   }
   
   FluffyBoard() {}
-  FluffyBoard(string desc): reserve{}, foundation{} {
-    size_t cascade = 0;
-    std::map<int8_t, int> read_cards;
-    for (size_t i = 0; i < desc.length(); ) {
-      while (i < desc.length() && (desc[i] == ' ' || desc[i] == '\t')) ++i;
-      if (i >= desc.length()) break;
-      
-      if (desc[i] == ':' || desc[i] == '\r' || desc[i] == '\n') {
-        cascade = 0; ++i;
-        continue;
-      }
-      
-      const size_t f = i;
-      while (i < desc.length() && !std::isspace(desc[i]) && desc[i] != ':') ++i;
-      string card_desc = desc.substr(f, i - f);
-      if (cascade >= cascades.size()) cascades.push_back({});
-      
-      Card card(card_desc);
-      cascades[cascade++].push_back(card);
-      ++read_cards[card.value];
-    }
-    if (read_cards.size() != 52) {
-      cerr << "WARNING: input does not contain all 52 card faces." << endl;
-      for (int s = 0; s < 4; ++s) {
-        for (int f = Card::Face::A; f <= Card::Face::K; ++f) {
-          Card card((Card::Face) f, (Card::Suit) s);
-          if (read_cards.find(card.value) == read_cards.end()) {
-            cerr << "- Missing " << card.str() << endl;
-          }
-        }
-      }
-    }
-    std::map<int, int> count_counts;
-    for (auto cn : read_cards) ++count_counts[cn.second];
-    if (count_counts.size() > 1) {
-      cerr << "WARNING: Some cards appear more frequently than others." << endl;
-      for (auto &ccr : count_counts) {
-        if (ccr.second < 26) {
-          cerr << "- The following cards appear " << ccr.first << " times:\n";
-          for (auto &cn : read_cards) {
-            if (cn.second == ccr.first) {
-              cerr << "  > " << Card(cn.first).str() << endl;
-            }
-          }
-        }
-      }
-    }
-  }
+  /// Reads a position in any form Board::parse() accepts, or aborts.
+  FluffyBoard(const string &desc, card_count_t cells = RESERVE_SIZE);
 };
 
 struct Board {
@@ -327,6 +390,10 @@ struct Board {
   Card cards[CARD_BANK_SIZE];
   card_count_t foundation[4] {};
   card_count_t cascade_divs[CASCADE_COUNT]; // Index after each cascade.
+  /// Reserve slots in play: fewer than RESERVE_SIZE for the one-, two- and
+  /// three-cell variants of the game. Slots past this are never filled. Every
+  /// board a search reaches has its deal's.
+  card_count_t cells = RESERVE_SIZE;
   
   struct CascadeView {
     const Card *const card;
@@ -359,11 +426,11 @@ struct Board {
   }
   
   bool cascade_empty(card_count_t i) const {
-    return (!i && !cascade_divs[0]) || cascade_divs[i] == 1 + cascade_divs[i-1];
+    return i ? cascade_divs[i] == 1 + cascade_divs[i - 1] : !cascade_divs[0];
   }
   
   bool reserve_full() const {
-    for (card_count_t i = 0; i < RESERVE_SIZE; ++i) {
+    for (card_count_t i = 0; i < cells; ++i) {
       if (!reserve[i]) return false;
     }
     return true;
@@ -381,6 +448,7 @@ struct Board {
     for (card_count_t i = 0; i < 4; ++i) {
       foundation[i] = b.foundation[i];
     }
+    cells = b.cells;
   }
   
   void copy_from_and_append(const Board &b, card_count_t cascade, Card append) {
@@ -391,7 +459,7 @@ struct Board {
     while (i < ce) cards[d++] = b.cards[i++];
     cards[d++] = append;
     while (d < CARD_BANK_SIZE) cards[d++] = b.cards[i++];
-#   ifdef DEBUG_MODE
+#   if SANITY_CHECKS >= 2
     if (i != CARD_BANK_SIZE - 1) {
       cerr << "Logic error: copied all but one card, but buffer was read to "
            << (int) i << " / " << (int) CARD_BANK_SIZE << " cards..." << endl;
@@ -424,7 +492,7 @@ struct Board {
       s = dto;
       while (s < CARD_BANK_SIZE) cards[d++] = b.cards[s++];
     }
-#   ifdef DEBUG_MODE
+#   if SANITY_CHECKS >= 2
     if (s != d) {
       cerr << "Logic error: copy with internal move resulted in different card "
            << "count (suddenly " << d << " instead of " << s << ")" << endl;
@@ -449,7 +517,7 @@ struct Board {
     const card_count_t lc = b.cascade_end(cascade) - 1;
     while (i < lc) cards[d++] = b.cards[i++];
     while (++i < CARD_BANK_SIZE) cards[d++] = b.cards[i];
-#   ifdef DEBUG_MODE
+#   if SANITY_CHECKS >= 2
     if (d != CARD_BANK_SIZE - 1) {
       cerr << "Logic error: copied all but one card, but buffer is full to "
            << (int) d << " / " << (int) CARD_BANK_SIZE << " cards..." << endl;
@@ -543,7 +611,7 @@ struct Board {
   }
   
   void reserve_card(Card c) {
-    for (card_count_t i = 0; i < RESERVE_SIZE; ++i) if (!reserve[i]) {
+    for (card_count_t i = 0; i < cells; ++i) if (!reserve[i]) {
       reserve[i] = c;
       return;
     }
@@ -563,7 +631,7 @@ struct Board {
   
   card_count_t count_free_reserves() const {
     card_count_t res = 0;
-    for (card_count_t i = 0; i < RESERVE_SIZE; ++i) if (!reserve[i]) ++res;
+    for (card_count_t i = 0; i < cells; ++i) if (!reserve[i]) ++res;
     return res;
   }
   
@@ -600,11 +668,231 @@ struct Board {
     for (size_t i = 0; i < RESERVE_SIZE; ++i) {
       res.reserve[i] = reserve[i];
     }
+    res.cells = cells;
     return res;
   }
   
+  /// Size of a board in its binary form: the reserve, the height of each
+  /// foundation, then the card bank with its zero separators.
+  constexpr static size_t PACKED_SIZE = RESERVE_SIZE + 4 + CARD_BANK_SIZE;
+  
+  void pack(uint8_t *out) const {
+    for (Card c : reserve) *out++ = c.value;
+    for (card_count_t f : foundation) *out++ = f;
+    for (Card c : cards) *out++ = c.value;
+  }
+  
+  /// Reads a board written by pack(). Returns false, leaving the board in an
+  /// unspecified state, if the bytes don't hold exactly one deck of cards,
+  /// each written just as pack() writes it.
+  bool unpack(const uint8_t *in) {
+    bool seen[64] {};
+    int total = 0;
+    auto see = [&](Card c) {
+      // A byte past the six bits a card uses would alias another card.
+      if (c.value & ~63) return false;
+      if (!c.face || c.face > Card::K || seen[c.value]) return false;
+      seen[c.value] = true;
+      return ++total, true;
+    };
+    for (Card &c : reserve) {
+      c.value = *in++;
+      if (c && !see(c)) return false;
+    }
+    for (card_count_t s = 0; s < 4; ++s) {
+      foundation[s] = *in++;
+      if (foundation[s] > Card::K) return false;
+      for (int f = Card::A; f <= foundation[s]; ++f) {
+        if (!see(Card((Card::Face) f, (Card::Suit) s))) return false;
+      }
+    }
+    card_count_t div = 0;
+    for (card_count_t i = 0; i < CARD_BANK_SIZE; ++i) {
+      cards[i].value = *in++;
+      if (!cards[i]) {
+        if (div < CASCADE_COUNT) cascade_divs[div++] = i;
+      } else if (div == CASCADE_COUNT || !see(cards[i])) {
+        return false;
+      }
+    }
+    return div == CASCADE_COUNT && total == TOTAL_CARDS;
+  }
+  
+  /// How the cascades of a position are written out: as rows across the
+  /// cascades, like the game files, or one cascade per line, from the card
+  /// buried deepest to the card on top, like most other solvers.
+  enum Layout { ROWS, COLUMNS };
+  
+  /// Reads a position: cascades, laid out as given, optionally with lines like
+  /// "Freecells: 9H - 4S" and "Foundations: 3S 2H" (or, in the other common
+  /// style, "Foundations: S-3 H-2 D-0 C-0"). In a row, a gap the width of a
+  /// card (as in "7H    5C") skips a cascade that has run out.
+  /// Cards that appear nowhere are taken to be on their foundations. Returns
+  /// false, with the reason, if the description isn't a legal position. The
+  /// number of `cells` is kept, and bounds the free cells it may fill.
+  bool parse(const string &desc, string *error, Layout layout = ROWS) {
+    Card grid[CASCADE_COUNT][TOTAL_CARDS];
+    card_count_t height[CASCADE_COUNT] {};
+    bool seen[64] {}, foundations_given = false;
+    for (Card &c : reserve) c.clear();
+    for (card_count_t &f : foundation) f = 0;
+    auto see = [&](Card c) {
+      if (seen[c.value & 63]) {
+        *error = "the " + c.str() + " appears twice";
+        return false;
+      }
+      return seen[c.value & 63] = true;
+    };
+    
+    card_count_t column = 0;
+    std::istringstream lines(desc);
+    for (string line; std::getline(lines, line); ) {
+      const size_t colon = line.find(':');
+      string label = colon == string::npos ? "" : line.substr(0, colon);
+      for (char &c : label) c = std::tolower(c);
+      while (!label.empty() && std::isspace(label[0])) label.erase(0, 1);
+      std::istringstream tokens(colon == string::npos ? "" : line.substr(colon + 1));
+      string token;
+      
+      if (label == "freecells" || label == "reserve") {
+        for (card_count_t slot = 0; tokens >> token; ++slot) {
+          Card c;
+          if (token.find_first_not_of("-.") == string::npos) continue;
+          if (!Card::read(token, &c)) {
+            *error = "\"" + token + "\" is not a card";
+            return false;
+          }
+          if (slot >= cells) {
+            *error = "there are only " + std::to_string(cells)
+                   + " free cells";
+            return false;
+          }
+          if (!see(c)) return false;
+          reserve[slot] = c;
+        }
+        continue;
+      }
+      
+      if (label == "foundations" || label == "foundation" || label == "home") {
+        foundations_given = true;
+        while (tokens >> token) {
+          int face = 0;
+          Card::Suit suit;
+          Card top;
+          const bool dashed = token.length() > 2 && token[1] == '-'
+              && Card::read_suit(token[0], &suit)
+              && (token.substr(2) == "0" || Card::read_face(token.substr(2), &face));
+          if (!dashed) {
+            if (!Card::read(token, &top)) {
+              *error = "\"" + token + "\" is not a foundation";
+              return false;
+            }
+            suit = (Card::Suit) top.suit;
+            face = top.face;
+          }
+          foundation[suit] = face;
+          for (int f = Card::A; f <= face; ++f) {
+            if (!see(Card((Card::Face) f, suit))) return false;
+          }
+        }
+        continue;
+      }
+      
+      if (!label.empty()) {
+        *error = "unknown line \"" + line + "\"";
+        return false;
+      }
+      // A cascade, or a row of cascades. The colon is optional.
+      const size_t begin = colon == string::npos ? 0 : colon + 1;
+      if (layout == COLUMNS) {
+        if (colon == string::npos && line.find_first_not_of(" \t\r") == string::npos) {
+          continue;
+        }
+        if (column >= CASCADE_COUNT) {
+          *error = "there are more than " + std::to_string(CASCADE_COUNT)
+                 + " cascades";
+          return false;
+        }
+        std::istringstream cascade(line.substr(begin));
+        while (cascade >> token) {
+          Card c;
+          if (!Card::read(token, &c)) {
+            *error = "\"" + token + "\" is not a card";
+            return false;
+          }
+          if (!see(c)) return false;
+          grid[column][height[column]++] = c;
+        }
+        ++column;
+        continue;
+      }
+      // Cards sit in three-character columns, so a wide gap of spaces
+      // between two cards, or between the colon and the first card, stands
+      // for the empty cascades it spans, as desc() writes them. Without a
+      // colon, leading spaces are just indentation. Column widths can't be
+      // told through a tab, so a gap with a tab in it is only ever one
+      // separator.
+      card_count_t col = 0;
+      for (size_t i = begin; i < line.length(); ) {
+        const size_t gap_start = i;
+        bool tab = false;
+        while (i < line.length() && std::isspace(line[i])) {
+          tab |= line[i++] == '\t';
+        }
+        if (i >= line.length()) break;
+        const size_t gap = i - gap_start;
+        const size_t f = i;
+        while (i < line.length() && !std::isspace(line[i])) ++i;
+        token = line.substr(f, i - f);
+        if (gap >= 4 && !tab && (gap_start != begin || colon != string::npos)) {
+          col += (gap - 1) / 3;
+        }
+        Card c;
+        if (!Card::read(token, &c)) {
+          *error = "\"" + token + "\" is not a card";
+          return false;
+        }
+        if (col >= CASCADE_COUNT) {
+          *error = "there are more than " + std::to_string(CASCADE_COUNT)
+                 + " cascades";
+          return false;
+        }
+        if (!see(c)) return false;
+        grid[col][height[col]++] = c;
+        ++col;
+      }
+    }
+    
+    for (card_count_t s = 0; s < 4; ++s) {
+      for (int f = Card::A; f <= Card::K; ++f) {
+        Card c((Card::Face) f, (Card::Suit) s);
+        if (seen[c.value & 63]) continue;
+        if (!foundations_given && f == foundation[s] + 1) {
+          foundation[s] = f;
+          continue;
+        }
+        *error = "the " + c.str() + " is missing";
+        if (!foundations_given) {
+          *error += ", but it can't be on the foundation while the "
+                  + Card((Card::Face) (foundation[s] + 1), (Card::Suit) s).str()
+                  + " is still in play";
+        }
+        return false;
+      }
+    }
+    
+    card_count_t d = 0;
+    for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+      for (card_count_t j = 0; j < height[i]; ++j) cards[d++] = grid[i][j];
+      cards[d].clear();
+      cascade_divs[i] = d++;
+    }
+    while (d < CARD_BANK_SIZE) cards[d++].clear();
+    return true;
+  }
+  
   Board() {}
-  Board(const FluffyBoard &b) {
+  Board(const FluffyBoard &b): cells(b.cells) {
     int total_cards = 0;
     for (card_count_t i = 0; i < 4; ++i) {
       if (b.foundation[i].value &&
@@ -652,6 +940,17 @@ struct Board {
 };
 using CascadeView = Board::CascadeView;
 
+FluffyBoard::FluffyBoard(const string &desc, card_count_t cells) {
+  Board board;
+  board.cells = cells;
+  string error;
+  if (!board.parse(desc, &error)) {
+    cerr << "Invalid board: " << error << "." << endl;
+    abort();
+  }
+  *this = board.inflate();
+}
+
 struct Move {
   enum Place : char { CASCADE = -3, RESERVE = -2, FOUNDATION = -1 };
   int8_t source; ///< Source Place or Card.
@@ -665,6 +964,27 @@ struct Move {
     return "Move " + name(source) + count_str + " onto " + name(dest);
   }
   
+  /// Reads back a move written by str(). Returns false if desc isn't one.
+  static bool parse(const string &desc, Move *out) {
+    static const string kMove = "Move ", kOnto = " onto ", kAnd = " (and ";
+    if (desc.compare(0, kMove.length(), kMove)) return false;
+    const size_t onto = desc.rfind(kOnto);
+    if (onto == string::npos || onto < kMove.length()) return false;
+    string src = desc.substr(kMove.length(), onto - kMove.length());
+    string dst = desc.substr(onto + kOnto.length());
+    while (!dst.empty() && std::isspace(dst.back())) dst.pop_back();
+    int count = 1;
+    const size_t more = src.find(kAnd);
+    if (more != string::npos) {
+      count = 1 + atoi(src.c_str() + more + kAnd.length());
+      src.erase(more);
+    }
+    int8_t s, d;
+    if (!unname(src, &s) || !unname(dst, &d)) return false;
+    *out = Move(Card(s), Card(d), count);
+    return true;
+  }
+  
   static const Move kGameStartMove;
   
   Move(Card c, Card d, int8_t count):
@@ -693,6 +1013,24 @@ struct Move {
     return "the " + Card(place).str();
   }
   
+  static bool unname(const string &name, int8_t *place) {
+    static const std::map<string, int8_t> places = [] {
+      std::map<string, int8_t> res;
+      for (int8_t p : { CASCADE, RESERVE, FOUNDATION }) res[Move::name(p)] = p;
+      for (int s = 0; s < 4; ++s) {
+        for (int f = Card::Face::A; f <= Card::Face::K; ++f) {
+          Card card((Card::Face) f, (Card::Suit) s);
+          res[Move::name(card.value)] = card.value;
+        }
+      }
+      return res;
+    }();
+    auto it = places.find(name);
+    if (it == places.end()) return false;
+    *place = it->second;
+    return true;
+  }
+  
   class GameStart {};
   Move(class GameStart): source(), dest(), count() {}
 };
@@ -703,7 +1041,10 @@ struct SearchBoard: Board {
   mutable const SearchBoard *previous;
   mutable Move action_taken;
   mutable unsigned depth;
-  int heuristic;
+  mutable int heuristic; ///< Set before the board is queued. Changed only
+                         ///< by a search that requeues boards it reaches
+                         ///< by shorter paths, keeping its own copy.
+  uint32_t id; ///< Order of insertion into the move graph.
   
   int num_moves() const {
     return depth;
@@ -779,110 +1120,781 @@ struct SearchBoard: Board {
 
   SearchBoard(const SearchBoard *prev, const Move &o_move):
       Board(), previous(prev), action_taken(o_move),
-      depth(prev->depth + 1), heuristic(0) {}
+      depth(prev->depth + 1), heuristic(0), id(0) {}
   SearchBoard(const Board& board, const SearchBoard *prev, const Move &o_move):
       Board(board), previous(prev), action_taken(o_move),
-      depth(prev->depth + 1), heuristic(0) {}
+      depth(prev->depth + 1), heuristic(0), id(0) {}
   SearchBoard(const Board& board):
       Board(board), previous(nullptr), action_taken(Move::kGameStartMove),
-      depth(0), heuristic(0) {}
+      depth(0), heuristic(0), id(0) {}
 };
 
-struct MoveDescription {
-  string action;
-  FluffyBoard result;
+/// A solution: the board it starts from and the moves that win it. The boards
+/// in between aren't kept; a Replay steps through the moves to get them back.
+struct MoveList {
+  Board start;
+  vector<Move> moves;
+  /// Which cascade each move onto "an empty cascade" took, in order, since
+  /// the move itself doesn't say and the search doesn't always take the first.
+  vector<card_count_t> empty_cascades;
   
-  MoveDescription(const Move &move, const Board &board):
-      action(move.str()), result(board.inflate()) {}
+  size_t size() const { return moves.size(); }
+  bool empty() const { return moves.empty(); }
+  
+  /// Walks the boards of a solution, one move at a time.
+  class Replay;
+  
+  /// Returns the board after the first `count` moves.
+  Board board_after(size_t count) const;
 };
 
-typedef vector<MoveDescription> MoveList;
 MoveList describeMoves(const SearchBoard &winning_board) {
   MoveList res;
-  res.reserve(winning_board.num_moves());
-  for (const SearchBoard *b = &winning_board; b->previous; b = b->previous) {
-    res.push_back(MoveDescription {b->action_taken, *b});
+  res.moves.reserve(winning_board.num_moves());
+  const SearchBoard *b = &winning_board;
+  for (; b->previous; b = b->previous) {
+    res.moves.push_back(b->action_taken);
+    if (b->action_taken.dest != Move::CASCADE) continue;
+    for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+      if (b->previous->cascade_empty(i) && !b->cascade_empty(i)) {
+        res.empty_cascades.push_back(i);
+        break;
+      }
+    }
   }
-  std::reverse(res.begin(), res.end());
+  res.start = *b;
+  std::reverse(res.moves.begin(), res.moves.end());
+  std::reverse(res.empty_cascades.begin(), res.empty_cascades.end());
   return res;
 }
 
 
 // =============================================================================
-// === Search Logic ============================================================
+// === Instrumentation =========================================================
 // =============================================================================
 
-std::unordered_set<SearchBoard, SearchBoard::Hash, SearchBoard::BasicallyEqual>
-typedef MoveGraph;
+using Clock = std::chrono::steady_clock;
 
-template<bool weights> struct SQT {
-  using T = const SearchBoard*;
-  struct SearchQ: priority_queue<T, std::vector<T>, SearchBoard::PtrLess> {
-    void pop_back() { c.pop_back(); }
-  };
-};
-template<> struct SQT<false> {
-  struct SearchQ: std::queue<const SearchBoard*> {
-    const SearchBoard *top() { return front(); }
-    void pop_back() { c.pop_back(); }
+string json_string(const string &str) {
+  string res = "\"";
+  for (char c : str) {
+    switch (c) {
+      case '"':  res += "\\\""; break;
+      case '\\': res += "\\\\"; break;
+      case '\n': res += "\\n"; break;
+      case '\r': res += "\\r"; break;
+      case '\t': res += "\\t"; break;
+      default:
+        if ((unsigned char) c < 0x20) {
+          static const char hex[] = "0123456789abcdef";
+          res += "\\u00";
+          res += hex[(c >> 4) & 0xF];
+          res += hex[c & 0xF];
+        } else {
+          res += c;
+        }
+    }
+  }
+  return res + "\"";
+}
+
+/// Collects Chrome trace events ("Trace Event Format" JSON, as read by
+/// chrome://tracing and Perfetto) from any number of threads.
+class ChromeTrace {
+  struct Event {
+    string name, category;
+    double start_us, duration_us;
+    int tid;
+    string args; ///< JSON object body, or empty.
   };
+  
+  std::mutex mutex;
+  vector<Event> events;
+  std::map<int, string> thread_names;
+  const Clock::time_point epoch = Clock::now();
+  std::atomic<int> next_tid {1};
+  
+  double micros(Clock::time_point t) const {
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+  }
+  
+ public:
+  /// A small, stable number for the calling thread.
+  int tid() {
+    thread_local int id = 0;
+    if (!id) id = next_tid++;
+    return id;
+  }
+  
+  void name_thread(const string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    thread_names[tid()] = name;
+  }
+  
+  /// Records a span of work on the calling thread.
+  void complete(const string &name, const char *category,
+                Clock::time_point start, Clock::time_point end,
+                const string &args = "") {
+    Event e { name, category, micros(start), micros(end) - micros(start),
+              tid(), args };
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back(std::move(e));
+  }
+  
+  void write(std::ostream &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (auto &t : thread_names) {
+      out << (first ? "" : ",\n") << "  {\"name\": \"thread_name\", "
+          << "\"ph\": \"M\", \"pid\": 1, \"tid\": " << t.first
+          << ", \"args\": {\"name\": " << json_string(t.second) << "}}";
+      first = false;
+    }
+    for (const Event &e : events) {
+      out << (first ? "" : ",\n") << "  {\"name\": " << json_string(e.name)
+          << ", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"ts\": "
+          << e.start_us << ", \"dur\": " << e.duration_us
+          << ", \"pid\": 1, \"tid\": " << e.tid;
+      if (!e.args.empty()) out << ", \"args\": {" << e.args << "}";
+      out << "}";
+      first = false;
+    }
+    out << "\n]}\n";
+  }
 };
 
-SQT<HEURISTIC_GREED || INACCESSIBILITY_PUNISHMENT || TABLEAU_REWARD>::SearchQ
-typedef SearchQueue;
+/// Trace events are collected here when --chrome-trace is given.
+ChromeTrace *chrome_trace = nullptr;
 
-struct AvailableMove {
-  Move move;
-  Board board;
+/// Wall time spent in each phase of a run, in seconds. PARSE reads the file
+/// and builds the compact Board from it; CONSTRUCT inflates that into the
+/// FluffyBoard that is printed and verified.
+struct PhaseTimings {
+  enum Phase {
+    PARSE, CONSTRUCT, SEARCH, RECONSTRUCT, OUTPUT, TEARDOWN, PHASE_COUNT
+  };
+  double seconds[PHASE_COUNT] {};
+  
+  static const char *name(Phase p) {
+    static const char *const names[PHASE_COUNT] = {
+      "parse", "construct", "search", "reconstruct", "output", "teardown"
+    };
+    return names[p];
+  }
+  
+  void add(Phase p, Clock::time_point since) {
+    std::chrono::duration<double> elapsed = Clock::now() - since;
+    seconds[p] += elapsed.count();
+  }
+  
+  double total() const {
+    double res = 0;
+    for (double s : seconds) res += s;
+    return res;
+  }
+  
+  string str() const {
+    std::ostringstream res;
+    const double sum = total();
+    res << "Phase timings:\n";
+    res.setf(std::ios::fixed);
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+      res.precision(6);
+      res << "  " << name((Phase) p)
+          << string(12 - string(name((Phase) p)).length(), ' ')
+          << seconds[p] << " s";
+      res.precision(1);
+      res << "  (" << (sum ? 100 * seconds[p] / sum : 0) << "%)\n";
+    }
+    res.precision(6);
+    res << "  total       " << sum << " s\n";
+    return res.str();
+  }
+  
+  string json() const {
+    std::ostringstream res;
+    res.precision(9);
+    res << "{";
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+      res << (p ? ", " : "") << '"' << name((Phase) p) << "\": " << seconds[p];
+    }
+    res << "}";
+    return res.str();
+  }
 };
 
-// End of type declarations.
+/// Adds the lifetime of this object to one phase of a PhaseTimings, if any,
+/// and records it as a trace event if a Chrome trace is being collected.
+class PhaseTimer {
+  PhaseTimings *const timings;
+  const PhaseTimings::Phase phase;
+  const Clock::time_point start;
+  
+ public:
+  PhaseTimer(PhaseTimings *t, PhaseTimings::Phase p):
+      timings(t), phase(p), start(Clock::now()) {}
+  ~PhaseTimer() {
+    if (timings) timings->add(phase, start);
+    if (chrome_trace) {
+      chrome_trace->complete(PhaseTimings::name(phase), "phase", start,
+                             Clock::now());
+    }
+  }
+};
 
-bool tableau_stackable(Card btm, Card top) {
-  if (!top) return false;
-  return (btm.face == top.face + 1 && btm.color() != top.color()) || !btm.value;
-}
 
-bool foundation_can_accept(const Board& b, Card c) {
-  return c && (b.foundation[c.suit] + 1) % Card::Face::K == c.face % Card::Face::K;
+/// Reads a field such as "VmHWM" from /proc/self/status, in kilobytes.
+/// Returns zero where that file doesn't exist.
+size_t proc_status_kb(const char *key) {
+  std::ifstream status("/proc/self/status");
+  const string prefix = string(key) + ":";
+  for (string line; std::getline(status, line); ) {
+    if (!line.compare(0, prefix.length(), prefix)) {
+      return strtoull(line.c_str() + prefix.length(), nullptr, 10);
+    }
+  }
+  return 0;
 }
 
-bool reserve_to_tableau_valid(const Board& b, int reserve, size_t cascade) {
-  return tableau_stackable(b.cascade_back(cascade), b.reserve[reserve]);
-}
+/// Bounded single-producer, single-consumer queue. Neither side ever blocks
+/// or locks; a full or empty ring is reported to the caller instead.
+template<typename T, size_t kCapacity> class SpscRing {
+  static_assert(!(kCapacity & (kCapacity - 1)), "Capacity must be 2^n");
+  T slots[kCapacity];
+  alignas(64) std::atomic<size_t> head {0}; ///< Next slot to be read.
+  alignas(64) std::atomic<size_t> tail {0}; ///< Next slot to be written.
+  
+ public:
+  bool try_push(const T &value) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == kCapacity) return false;
+    slots[t & (kCapacity - 1)] = value;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  
+  bool try_pop(T &value) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    value = slots[h & (kCapacity - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  
+  /// Pops up to `max` values into `out`, returning the number popped.
+  size_t pop_bulk(T *out, size_t max) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    const size_t n = std::min(max, tail.load(std::memory_order_acquire) - h);
+    for (size_t i = 0; i < n; ++i) out[i] = slots[(h + i) & (kCapacity - 1)];
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+  
+  bool empty() const {
+    return head.load(std::memory_order_acquire)
+        == tail.load(std::memory_order_acquire);
+  }
+};
 
-SearchBoard reserve_to_tableau(const SearchBoard &b, int reserve, int cascade) {
-  SearchBoard res { &b, Move(b.reserve[reserve], b.cascade(cascade)) };
-  res.copy_from_and_append(b, cascade, b.reserve[reserve]);
-  res.reserve[reserve].value = 0;
-  return res;
-}
+/// One event in a binary search trace.
+struct TraceRecord {
+  enum Kind: uint8_t {
+    NEW,       ///< A child was generated and added to the move graph.
+    DUPLICATE, ///< A child was generated, but was already in the graph.
+    EXPAND,    ///< A board was popped from the queue and expanded.
+    DROP,      ///< A board was discarded from the queue to bound memory.
+    SOLUTION,  ///< A board on the final path; emitted root-first at the end.
+  };
+  static constexpr uint32_t kNoParent = ~0u;
+  
+  uint32_t node;      ///< SearchBoard::id of the board concerned.
+  uint32_t parent;    ///< SearchBoard::id of its predecessor, or kNoParent.
+  int32_t heuristic;
+  uint32_t micros;    ///< Time since the trace was opened.
+  uint16_t depth;
+  int8_t source, dest, count; ///< The Move that produced the board.
+  Kind kind;
+  uint8_t reserved[2];
+};
+static_assert(sizeof(TraceRecord) == 24);
 
-SearchBoard tableaux_move(const SearchBoard &b,
-    card_count_t source, card_count_t dest, card_count_t count) {
-  SearchBoard res { &b, Move(b.cascade(source), b.cascade(dest), count) };
-  res.copy_from_but_move(b, source, dest, count);
-  return res;
-}
+constexpr char kTraceMagic[8] = { 'F', 'C', 'T', 'R', 'A', 'C', 'E', '1' };
 
-SearchBoard tableau_to_reserve(const SearchBoard &b, card_count_t source) {
-  SearchBoard res { &b, Move(b.cascade(source), Move::Place::RESERVE) };
-  res.copy_from_but_remove(b, source);
-  res.reserve_card(b.cascade_back(source));
-  return res;
-}
+/// Records search events into a file. Events are queued into a lock-free ring
+/// by the search thread and written out by a background thread, so the search
+/// only ever pays for a copy into the ring (or, if the disk can't keep up, for
+/// waiting on it).
+class TraceWriter {
+  static constexpr size_t kRingSize = 1 << 16;
+  
+  std::ofstream out;
+  std::unique_ptr<SpscRing<TraceRecord, kRingSize>> ring;
+  std::atomic<bool> done {false};
+  std::thread flusher;
+  const Clock::time_point start;
+  size_t stalls = 0;
+  
+  void flush_loop() {
+    vector<TraceRecord> buf(kRingSize / 4);
+    for (;;) {
+      const bool finishing = done.load(std::memory_order_acquire);
+      size_t n = ring->pop_bulk(buf.data(), buf.size());
+      if (n) {
+        out.write((const char*) buf.data(), n * sizeof(TraceRecord));
+      } else if (finishing) {
+        break;
+      } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    out.flush();
+  }
+  
+ public:
+  size_t records = 0;
+  
+  bool good() const { return (bool) out; }
+  
+  void record(TraceRecord::Kind kind, const SearchBoard &board,
+              const SearchBoard *parent, uint32_t node) {
+    TraceRecord rec;
+    rec.node = node;
+    rec.parent = parent ? parent->id : TraceRecord::kNoParent;
+    rec.heuristic = board.heuristic;
+    rec.micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - start).count();
+    rec.depth = board.depth;
+    rec.source = board.action_taken.source;
+    rec.dest = board.action_taken.dest;
+    rec.count = board.action_taken.count;
+    rec.kind = kind;
+    rec.reserved[0] = rec.reserved[1] = 0;
+    while (!ring->try_push(rec)) {
+      ++stalls;
+      std::this_thread::yield();
+    }
+    ++records;
+  }
+  
+  void record(TraceRecord::Kind kind, const SearchBoard &board) {
+    record(kind, board, board.previous, board.id);
+  }
+  
+  TraceWriter(const string &fname):
+      out(fname, std::ios::binary), ring(new SpscRing<TraceRecord, kRingSize>),
+      start(Clock::now()) {
+    if (!out) return;
+    out.write(kTraceMagic, sizeof(kTraceMagic));
+    flusher = std::thread(&TraceWriter::flush_loop, this);
+  }
+  
+  ~TraceWriter() {
+    done.store(true, std::memory_order_release);
+    if (flusher.joinable()) flusher.join();
+    if (stalls) {
+      cerr << "Trace writer fell behind; search stalled " << stalls
+           << " times waiting on disk." << endl;
+    }
+  }
+};
 
-SearchBoard tableau_to_foundation(const SearchBoard &b, card_count_t source) {
-  SearchBoard res { &b, Move(b.cascade(source), Move::Place::FOUNDATION) };
-  res.copy_from_but_remove(b, source);
-  res.foundation[b.cascade_back(source).suit]++;
-  return res;
-}
+/// Trace of the search running on this thread, if one was requested.
+thread_local TraceWriter *search_trace = nullptr;
 
-bool foundation_to_tableau_valid(
-    const Board& board, card_count_t foundation, card_count_t cascade) {
-  if (!board.foundation[foundation]) return false;
-  Card onto = board.cascade_back(cascade);
+/// Hardware performance counters for the calling thread, via perf_event_open.
+/// Each counter is opened on its own, so a machine or VM that lacks one event
+/// still reports the rest; if none can be opened (no PMU, or forbidden by
+/// perf_event_paranoid), available() is false and every call is a no-op.
+///
+/// Besides counting the whole search loop, the counters can attribute cost to
+/// the phases of expanding a board. Reading them takes a system call per
+/// counter, so this is done only for a sample of expansions.
+class PerfCounters {
+ public:
+  enum Event {
+    CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, DTLB_MISSES,
+    EVENT_COUNT
+  };
+  enum Phase { GENERATE, HEURISTIC, INSERT, PHASE_COUNT, IDLE = PHASE_COUNT };
+  static constexpr unsigned kSampleInterval = 256;
+  
+  struct Counts {
+    uint64_t value[EVENT_COUNT] {};
+    Counts &operator+=(const Counts &o) {
+      for (int e = 0; e < EVENT_COUNT; ++e) value[e] += o.value[e];
+      return *this;
+    }
+  };
+  
+  Counts loop;                ///< Counts over the whole search loop.
+  Counts phases[PHASE_COUNT]; ///< Counts over sampled expansions, by phase.
+  size_t sampled = 0;         ///< Number of expansions sampled.
+  string error;               ///< Why counters are unavailable, if they are.
+  
+  static const char *name(Event e) {
+    static const char *const names[EVENT_COUNT] = {
+      "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+      "dtlb_misses"
+    };
+    return names[e];
+  }
+  
+  static const char *name(Phase p) {
+    static const char *const names[PHASE_COUNT] = {
+      "generate", "heuristic", "insert"
+    };
+    return names[p];
+  }
+  
+  bool available() const {
+    for (int f : fd) if (f >= 0) return true;
+    return false;
+  }
+  bool has(Event e) const { return fd[e] >= 0; }
+  
+  void start_loop() {
+    if (available()) loop_start = read();
+  }
+  void stop_loop() {
+    if (available()) accumulate(loop, loop_start, read());
+  }
+  
+  /// Starts or stops sampling the phases of one expansion.
+  void sample(bool enable) {
+    if (!available()) return;
+    if (enable) {
+      ++sampled;
+      phase_start = read();
+      current = GENERATE;
+    } else {
+      phase(IDLE);
+    }
+  }
+  
+  /// Charges everything since the last phase change to the current phase.
+  void phase(Phase next) {
+    if (current == IDLE) return;
+    Counts now = read();
+    accumulate(phases[current], phase_start, now);
+    phase_start = now;
+    current = next;
+  }
+  
+  string str(size_t expanded) const {
+    std::ostringstream res;
+    res.setf(std::ios::fixed);
+    if (!available()) {
+      res << "Hardware counters unavailable: " << error << "\n";
+      return res.str();
+    }
+    const double per = expanded ? 1.0 / expanded : 0;
+    res << "Hardware counters (search loop, " << expanded
+        << " boards expanded):\n";
+    for (int e = 0; e < EVENT_COUNT; ++e) {
+      res.precision(1);
+      res << "  " << name((Event) e) << string(16 - strlen(name((Event) e)), ' ');
+      if (!has((Event) e)) { res << "n/a\n"; continue; }
+      res << loop.value[e] << "  (" << loop.value[e] * per << " per board)\n";
+    }
+    if (has(CYCLES) && has(INSTRUCTIONS) && loop.value[CYCLES]) {
+      res.precision(2);
+      res << "  IPC             "
+          << (double) loop.value[INSTRUCTIONS] / loop.value[CYCLES] << "\n";
+    }
+    if (sampled) {
+      res << "Per board, by phase (sampled 1 in " << kSampleInterval
+          << " expansions; " << sampled << " samples):\n"
+          << "  phase       ";
+      for (int e = 0; e < EVENT_COUNT; ++e) {
+        if (has((Event) e)) res << std::setw(14) << name((Event) e);
+      }
+      res << "     IPC\n";
+      for (int p = 0; p < PHASE_COUNT; ++p) {
+        const Counts &c = phases[p];
+        res << "  " << name((Phase) p)
+            << string(12 - strlen(name((Phase) p)), ' ');
+        res.precision(1);
+        for (int e = 0; e < EVENT_COUNT; ++e) {
+          if (has((Event) e)) {
+            res << std::setw(14) << (double) c.value[e] / sampled;
+          }
+        }
+        res.precision(2);
+        if (has(CYCLES) && has(INSTRUCTIONS) && c.value[CYCLES]) {
+          res << std::setw(8)
+              << (double) c.value[INSTRUCTIONS] / c.value[CYCLES];
+        }
+        res << "\n";
+      }
+    }
+    return res.str();
+  }
+  
+  string json(size_t expanded) const {
+    std::ostringstream res;
+    if (!available()) {
+      res << "{\"available\": false, \"error\": " << json_string(error) << "}";
+      return res.str();
+    }
+    auto counts = [&](const Counts &c) {
+      res << "{";
+      bool first = true;
+      for (int e = 0; e < EVENT_COUNT; ++e) {
+        if (!has((Event) e)) continue;
+        res << (first ? "" : ", ") << '"' << name((Event) e) << "\": "
+            << c.value[e];
+        first = false;
+      }
+      res << "}";
+    };
+    res << "{\"available\": true, \"expanded\": " << expanded << ", \"loop\": ";
+    counts(loop);
+    res << ", \"sampled\": " << sampled << ", \"phases\": {";
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+      res << (p ? ", " : "") << '"' << name((Phase) p) << "\": ";
+      counts(phases[p]);
+    }
+    res << "}}";
+    return res.str();
+  }
+  
+  PerfCounters() {
+    for (int &f : fd) f = -1;
+#   ifdef __linux__
+    struct { uint32_t type; uint64_t config; } events[EVENT_COUNT] = {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                          | PERF_COUNT_HW_CACHE_OP_READ << 8
+                          | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+                          | PERF_COUNT_HW_CACHE_OP_READ << 8
+                          | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    };
+    for (int e = 0; e < EVENT_COUNT; ++e) {
+      perf_event_attr attr {};
+      attr.size = sizeof(attr);
+      attr.type = events[e].type;
+      attr.config = events[e].config;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                       | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fd[e] < 0 && error.empty()) {
+        error = string("perf_event_open: ") + strerror(errno);
+        if (errno == EACCES || errno == EPERM) {
+          error += " (see /proc/sys/kernel/perf_event_paranoid)";
+        }
+      }
+    }
+#   else
+    error = "not supported on this platform";
+#   endif
+  }
+  
+  ~PerfCounters() {
+#   ifdef __linux__
+    for (int f : fd) if (f >= 0) close(f);
+#   endif
+  }
+  
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters &operator=(const PerfCounters&) = delete;
+  
+ private:
+  int fd[EVENT_COUNT];
+  Counts loop_start, phase_start;
+  Phase current = IDLE;
+  
+  /// Reads every counter, scaled up for any time it was multiplexed out.
+  Counts read() const {
+    Counts res;
+#   ifdef __linux__
+    for (int e = 0; e < EVENT_COUNT; ++e) {
+      uint64_t buf[3]; // value, time enabled, time running
+      if (fd[e] < 0 || ::read(fd[e], buf, sizeof(buf)) != sizeof(buf)) continue;
+      res.value[e] = buf[2] && buf[2] < buf[1]
+          ? (uint64_t) ((double) buf[0] * buf[1] / buf[2]) : buf[0];
+    }
+#   endif
+    return res;
+  }
+  
+  static void accumulate(Counts &into, const Counts &from, const Counts &to) {
+    for (int e = 0; e < EVENT_COUNT; ++e) into.value[e] += to.value[e] - from.value[e];
+  }
+};
+
+/// Counters for the search running on this thread, if they were requested.
+thread_local PerfCounters *search_perf = nullptr;
+
+
+// =============================================================================
+// === Search Logic ============================================================
+// =============================================================================
+
+/// Hands out fixed-size nodes, keeping freed ones for reuse, so a move graph
+/// that is cleared and refilled stops going to the heap once it has been as
+/// big as it's going to get. Memory goes back only when the pool dies.
+class NodePool {
+ public:
+  NodePool() {}
+  NodePool(const NodePool&) = delete;
+  ~NodePool() { for (char *chunk : chunks) ::operator delete(chunk); }
+  
+  /// Whether the pool serves nodes of this size. The first size asked for
+  /// is the one it serves.
+  bool fits(size_t bytes) {
+    if (!node_bytes) node_bytes = std::max(bytes, sizeof(void*));
+    return bytes == node_bytes;
+  }
+  
+  void *take() {
+    if (free_list) {
+      void *node = free_list;
+      free_list = *(void**) node;
+      return node;
+    }
+    if (chunk_left < node_bytes) {
+      chunks.push_back((char*) ::operator new(kChunkBytes));
+      chunk_next = chunks.back();
+      chunk_left = kChunkBytes;
+    }
+    void *node = chunk_next;
+    chunk_next += node_bytes;
+    chunk_left -= node_bytes;
+    return node;
+  }
+  
+  void give(void *node) {
+    *(void**) node = free_list;
+    free_list = node;
+  }
+  
+  size_t bytes_held() const { return chunks.size() * kChunkBytes; }
+  
+ private:
+  static constexpr size_t kChunkBytes = 1 << 20;
+  vector<char*> chunks;
+  char *chunk_next = nullptr;
+  size_t chunk_left = 0;
+  size_t node_bytes = 0;
+  void *free_list = nullptr;
+};
+
+/// Allocates single nodes from a NodePool, if it was given one, and
+/// everything else (and everything, if not) from the heap.
+template<typename T> struct PoolAllocator {
+  using value_type = T;
+  NodePool *pool = nullptr;
+  
+  PoolAllocator() {}
+  explicit PoolAllocator(NodePool *pool): pool(pool) {}
+  template<typename U> PoolAllocator(const PoolAllocator<U> &other):
+      pool(other.pool) {}
+  
+  T *allocate(size_t n) {
+    if (n == 1 && pool && pool->fits(sizeof(T))) return (T*) pool->take();
+    return (T*) ::operator new(n * sizeof(T));
+  }
+  void deallocate(T *p, size_t n) {
+    if (n == 1 && pool && pool->fits(sizeof(T))) pool->give(p);
+    else ::operator delete(p);
+  }
+  
+  template<typename U> bool operator==(const PoolAllocator<U> &o) const {
+    return pool == o.pool;
+  }
+  template<typename U> bool operator!=(const PoolAllocator<U> &o) const {
+    return pool != o.pool;
+  }
+};
+
+std::unordered_set<SearchBoard, SearchBoard::Hash, SearchBoard::BasicallyEqual,
+                   PoolAllocator<SearchBoard>>
+typedef MoveGraph;
+
+template<bool weights> struct SQT {
+  using T = const SearchBoard*;
+  struct SearchQ: priority_queue<T, std::vector<T>, SearchBoard::PtrLess> {
+    T back() const { return c.back(); }
+    const std::vector<T> &entries() const { return c; }
+    size_t capacity() const { return c.capacity(); }
+    void pop_back() { c.pop_back(); }
+    void clear() { c.clear(); }
+  };
+};
+template<> struct SQT<false> {
+  struct SearchQ: std::queue<const SearchBoard*> {
+    const SearchBoard *top() { return front(); }
+    const container_type &entries() const { return c; }
+    size_t capacity() const { return c.size(); }
+    void pop_back() { c.pop_back(); }
+    void clear() { c.clear(); }
+  };
+};
+
+SQT<HEURISTIC_GREED || INACCESSIBILITY_PUNISHMENT || TABLEAU_REWARD>::SearchQ
+typedef SearchQueue;
+
+struct AvailableMove {
+  Move move;
+  Board board;
+};
+
+// End of type declarations.
+
+bool tableau_stackable(Card btm, Card top) {
+  if (!top) return false;
+  return (btm.face == top.face + 1 && btm.color() != top.color()) || !btm.value;
+}
+
+bool foundation_can_accept(const Board& b, Card c) {
+  return c && (b.foundation[c.suit] + 1) % Card::Face::K == c.face % Card::Face::K;
+}
+
+bool reserve_to_tableau_valid(const Board& b, int reserve, size_t cascade) {
+  return tableau_stackable(b.cascade_back(cascade), b.reserve[reserve]);
+}
+
+SearchBoard reserve_to_tableau(const SearchBoard &b, int reserve, int cascade) {
+  SearchBoard res { &b, Move(b.reserve[reserve], b.cascade(cascade)) };
+  res.copy_from_and_append(b, cascade, b.reserve[reserve]);
+  res.reserve[reserve].value = 0;
+  return res;
+}
+
+SearchBoard tableaux_move(const SearchBoard &b,
+    card_count_t source, card_count_t dest, card_count_t count) {
+  SearchBoard res { &b, Move(b.cascade(source), b.cascade(dest), count) };
+  res.copy_from_but_move(b, source, dest, count);
+  return res;
+}
+
+SearchBoard tableau_to_reserve(const SearchBoard &b, card_count_t source) {
+  SearchBoard res { &b, Move(b.cascade(source), Move::Place::RESERVE) };
+  res.copy_from_but_remove(b, source);
+  res.reserve_card(b.cascade_back(source));
+  return res;
+}
+
+SearchBoard tableau_to_foundation(const SearchBoard &b, card_count_t source) {
+  SearchBoard res { &b, Move(b.cascade(source), Move::Place::FOUNDATION) };
+  res.copy_from_but_remove(b, source);
+  res.foundation[b.cascade_back(source).suit]++;
+  return res;
+}
+
+bool foundation_to_tableau_valid(
+    const Board& board, card_count_t foundation, card_count_t cascade) {
+  if (!board.foundation[foundation]) return false;
+  Card onto = board.cascade_back(cascade);
   if (!onto) return true;
   if (Card::color((Card::Suit) foundation) == onto.color()) return false;
   return board.foundation[foundation] == onto.face - 1;
@@ -904,146 +1916,4597 @@ SearchBoard reserve_to_foundation(const SearchBoard &b, size_t reserve) {
   return res;
 }
 
-void visit(
-    vector<const SearchBoard*> &dest, SearchBoard &&board, MoveGraph &graph) {
-  board.heuristic = board.calc_heuristic();
-# ifdef DEBUG_MODE
-    board.check_sanity();
-# endif
-  auto ins = graph.insert(std::move(board));
-  if (ins.second) {
-    dest.push_back(&*ins.first);
-  } else {
-    if (board.previous) {
-      if (board.previous->depth + 1 < ins.first->depth) {
-        ins.first->depth = board.previous->depth + 1;
-        ins.first->previous = board.previous;
-        ins.first->action_taken = board.action_taken;
-      }
-    }
+/// Where a move takes its cards from and puts them: a cascade or reserve slot
+/// by index, or a foundation by suit.
+struct MoveSpots {
+  Move::Place from, to;
+  card_count_t from_index, to_index;
+};
+
+/// Plays a move from a solution on a board, as the search made it. Moves name
+/// only cards, so "an empty reserve" or "an empty cascade" means the one at
+/// index `slot` if given, or else the first one.
+/// Returns false, leaving the board alone, if the move doesn't fit it.
+bool replay_move(Board &board, const Move &move, MoveSpots *spots = nullptr,
+                 int slot = -1) {
+  const SearchBoard b { board };
+  const Card src(move.source);
+  MoveSpots at { Move::FOUNDATION, Move::FOUNDATION, src.suit, 0 };
+  for (card_count_t i = 0; i < RESERVE_SIZE; ++i) {
+    if (board.reserve[i] && board.reserve[i].value == move.source) {
+      at.from = Move::RESERVE, at.from_index = i;
+    }
+  }
+  for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+    if (board.cascade_back(i) && board.cascade_back(i).value == move.source) {
+      at.from = Move::CASCADE, at.from_index = i;
+    }
+  }
+  if (at.from == Move::FOUNDATION && board.foundation[src.suit] != src.face) {
+    return false;
+  }
+  
+  switch (move.dest) {
+    case Move::FOUNDATION:
+      at.to_index = src.suit;
+      break;
+    case Move::RESERVE:
+      at.to = Move::RESERVE;
+      if (slot >= 0) {
+        at.to_index = slot;
+        if (at.to_index >= board.cells || board.reserve[slot]) return false;
+        break;
+      }
+      for (at.to_index = 0; at.to_index < board.cells
+           && board.reserve[at.to_index]; ++at.to_index);
+      if (at.to_index == board.cells) return false;
+      break;
+    default:
+      at.to = Move::CASCADE;
+      if (move.dest == Move::CASCADE && slot >= 0) {
+        at.to_index = slot;
+        if (at.to_index >= CASCADE_COUNT || board.cascade_back(at.to_index)) {
+          return false;
+        }
+        break;
+      }
+      for (at.to_index = 0; at.to_index < CASCADE_COUNT; ++at.to_index) {
+        const Card back = board.cascade_back(at.to_index);
+        if (move.dest == Move::CASCADE ? !back : back.value == move.dest) break;
+      }
+      if (at.to_index == CASCADE_COUNT) return false;
+  }
+  
+  if (at.from == Move::CASCADE && at.to == Move::CASCADE) {
+    board = tableaux_move(b, at.from_index, at.to_index, move.count);
+  } else if (move.count != 1) {
+    return false;
+  } else if (at.from == Move::CASCADE) {
+    board = at.to == Move::RESERVE ? tableau_to_reserve(b, at.from_index)
+                                   : tableau_to_foundation(b, at.from_index);
+    // The reserve's order doesn't matter to the search, so honor the slot.
+    for (card_count_t i = 0; i < at.to_index && at.to == Move::RESERVE; ++i) {
+      if (board.reserve[i].value == move.source) {
+        std::swap(board.reserve[i], board.reserve[at.to_index]);
+      }
+    }
+  } else if (at.from == Move::RESERVE && at.to != Move::RESERVE) {
+    board = at.to == Move::CASCADE
+        ? reserve_to_tableau(b, at.from_index, at.to_index)
+        : reserve_to_foundation(b, at.from_index);
+  } else if (at.from == Move::FOUNDATION && at.to == Move::CASCADE) {
+    board = foundation_to_tableau(b, at.from_index, at.to_index);
+  } else {
+    return false;
+  }
+  if (spots) *spots = at;
+  return true;
+}
+
+class MoveList::Replay {
+ public:
+  explicit Replay(const MoveList &list): list(list), board(list.start) {}
+  
+  /// Plays the next move. Returns false at the end of the solution, or if the
+  /// move doesn't fit the board.
+  bool next(MoveSpots *spots = nullptr) {
+    if (played == list.moves.size()) return false;
+    const Move &move = list.moves[played];
+    int empty = -1;
+    if (move.dest == Move::CASCADE && choices < list.empty_cascades.size()) {
+      empty = list.empty_cascades[choices];
+    }
+    if (!replay_move(board, move, spots, empty)) return false;
+    if (move.dest == Move::CASCADE) ++choices;
+    ++played;
+    return true;
+  }
+  
+  const Board &current() const { return board; }
+  /// The move just played.
+  const Move &last() const { return list.moves[played - 1]; }
+  size_t moves_played() const { return played; }
+  
+ private:
+  const MoveList &list;
+  Board board;
+  size_t played = 0, choices = 0;
+};
+
+Board MoveList::board_after(size_t count) const {
+  Replay replay(*this);
+  while (replay.moves_played() < std::min(count, moves.size())) {
+    if (!replay.next()) {
+      cerr << "Logic error: solution does not replay at move "
+           << replay.moves_played() + 1 << "." << endl;
+      abort();
+    }
+  }
+  return replay.current();
+}
+
+/// The boards produced by expanding one board.
+struct Expansion {
+  vector<const SearchBoard*> children; ///< Boards new to the move graph.
+  size_t duplicates = 0;               ///< Boards that were already in it.
+  /// Also return known boards that this expansion found a shorter path to.
+  bool reopen = false;
+};
+
+/// Check the invariants of every Nth generated board; 0 checks none.
+unsigned sanity_interval = SANITY_CHECKS >= 2 ? 1 : SANITY_CHECKS ? 1024 : 0;
+thread_local unsigned sanity_countdown = 0;
+
+/// Parses "off", "full", "sampled", or "sampled:N" into a sanity_interval.
+bool parse_sanity(const string &desc, unsigned *interval) {
+  if (desc == "off") *interval = 0;
+  else if (desc == "full") *interval = 1;
+  else if (desc == "sampled") *interval = 1024;
+  else if (desc.compare(0, 8, "sampled:") == 0) {
+    char *end;
+    const unsigned long n = strtoul(desc.c_str() + 8, &end, 10);
+    if (*end || !n || n > UINT32_MAX) return false;
+    *interval = n;
+  } else {
+    return false;
+  }
+  if (*interval && !SANITY_CHECKS) {
+    cerr << "Sanity checks were compiled out (SANITY_CHECKS=0)." << endl;
+    return false;
+  }
+  return true;
+}
+
+void visit(Expansion &dest, SearchBoard &&board, MoveGraph &graph) {
+# if SANITY_CHECKS
+    if (sanity_interval && !sanity_countdown--) {
+      sanity_countdown = sanity_interval - 1;
+      board.check_sanity();
+    }
+# endif
+  if (search_perf) search_perf->phase(PerfCounters::HEURISTIC);
+  board.heuristic = board.calc_heuristic();
+  if (search_perf) search_perf->phase(PerfCounters::INSERT);
+  board.id = graph.size();
+  auto ins = graph.insert(std::move(board));
+  if (search_perf) search_perf->phase(PerfCounters::GENERATE);
+  if (ins.second) {
+    if (search_trace) search_trace->record(TraceRecord::NEW, *ins.first);
+    dest.children.push_back(&*ins.first);
+  } else {
+    ++dest.duplicates;
+    if (search_trace) {
+      search_trace->record(TraceRecord::DUPLICATE, board, board.previous,
+                           ins.first->id);
+    }
+    if (board.previous) {
+      if (board.previous->depth + 1 < ins.first->depth) {
+        ins.first->depth = board.previous->depth + 1;
+        ins.first->previous = board.previous;
+        ins.first->action_taken = board.action_taken;
+        if (dest.reopen) {
+          // The heuristic charges for the moves made so far, which just fell.
+          ins.first->heuristic = ins.first->calc_heuristic();
+          dest.children.push_back(&*ins.first);
+        }
+      }
+    }
+  }
+}
+
+/// Builds every child of a board, in a fixed order, passing each to `take`.
+template<typename F> void for_each_child(const SearchBoard &board, F &&take) {
+  card_count_t num_free_reserves = board.count_free_reserves();
+  card_count_t num_empty_cascades = board.count_empty_cascades();
+  for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+    for (card_count_t j = 0; j < RESERVE_SIZE; ++j)  {
+      if (reserve_to_tableau_valid(board, j, i)) {
+        take(reserve_to_tableau(board, j, i));
+      }
+    }
+    
+    if (board.cascade_empty(i)) continue;
+
+    card_count_t size = board.cascade_size(i);
+    card_count_t back = board.cascade_end(i);
+    for (card_count_t j = 0; j < CASCADE_COUNT; ++j) {
+      for (card_count_t l = 1; ; ) {
+        Card cur = board.cards[back - l];
+        if (tableau_stackable(board.cascade_back(j), cur)) {
+          take(tableaux_move(board, i, j, l));
+        }
+        if (++l > size) break;
+        if (!tableau_stackable(board.cards[back - l], cur)) break;
+        if (l > num_free_reserves + num_empty_cascades) break;
+        // XXX: It would be wise to use * above instead of +, except some
+        // freecell engines don't allow complicated automatic moves.
+      }
+    }
+    
+    if (!board.reserve_full())  {
+      take(tableau_to_reserve(board, i));
+    }
+    
+    if (foundation_can_accept(board, board.cascade_back(i))) {
+      take(tableau_to_foundation(board, i));
+    }
+    
+    for (card_count_t j = 0; j < 4; ++j) {
+      if (foundation_to_tableau_valid(board, j, i)) {
+        take(foundation_to_tableau(board, j, i));
+      }
+    }
+  }
+  
+  for (card_count_t i = 0; i < RESERVE_SIZE; ++i)  {
+    if (foundation_can_accept(board, board.reserve[i])) {
+      take(reserve_to_foundation(board, i));
+    }
+  }
+}
+
+/// Expands a board into `res`, reusing its storage.
+void possible_moves(const SearchBoard &board, MoveGraph &move_graph,
+                    Expansion &res) {
+  res.children.clear();
+  res.duplicates = 0;
+  for_each_child(board, [&](SearchBoard &&child) {
+    visit(res, std::move(child), move_graph);
+  });
+}
+
+Expansion possible_moves(const SearchBoard &board, MoveGraph &move_graph,
+                         bool reopen = false) {
+  Expansion res;
+  res.reopen = reopen;
+  possible_moves(board, move_graph, res);
+  return res;
+}
+
+/// Finds the moves from many boards at once. The boards' features are laid
+/// out field by field, one lane per board, so that each rule of the game runs
+/// as a straight loop over the lanes that the compiler can turn into vector
+/// instructions; only then are the children that pass built and visited.
+/// Finds exactly the moves possible_moves() does.
+struct BoardBatch {
+  static constexpr size_t kLanes = 32;
+  
+  size_t count = 0;
+  const SearchBoard *boards[kLanes];
+  
+  // The features of each board, one lane per board.
+  uint8_t back_face[CASCADE_COUNT][kLanes];
+  uint8_t back_suit[CASCADE_COUNT][kLanes];
+  uint8_t back_red[CASCADE_COUNT][kLanes];
+  uint8_t run[CASCADE_COUNT][kLanes]; ///< Cards in sequence at the back.
+  uint8_t reserve_face[RESERVE_SIZE][kLanes];
+  uint8_t reserve_suit[RESERVE_SIZE][kLanes];
+  uint8_t reserve_red[RESERVE_SIZE][kLanes];
+  uint8_t foundation[4][kLanes];
+  uint8_t free_reserves[kLanes];
+  uint8_t empty_cascades[kLanes];
+  
+  // The moves found, a byte per move and lane that is 1 if the move can be
+  // made. Unlike bit masks, these take plain stores, which vectorize.
+  uint8_t reserve_to_cascade[RESERVE_SIZE][CASCADE_COUNT][kLanes];
+  uint8_t cascade_to_cascade[CASCADE_COUNT][CASCADE_COUNT][kLanes];
+  uint8_t foundation_to_cascade[4][CASCADE_COUNT][kLanes];
+  uint8_t cascade_to_reserve[CASCADE_COUNT][kLanes];
+  uint8_t cascade_to_foundation[CASCADE_COUNT][kLanes];
+  uint8_t reserve_to_foundation[RESERVE_SIZE][kLanes];
+  uint8_t longest_move[CASCADE_COUNT][kLanes]; ///< Most cards one move takes.
+  
+  /// Lays out up to kLanes boards. Unused lanes hold empty boards, which
+  /// have no moves.
+  void load(const SearchBoard *const *from, size_t n) {
+    count = std::min(n, kLanes);
+    std::fill_n(&back_face[0][0], sizeof(back_face), 0);
+    std::fill_n(&run[0][0], sizeof(run), 0);
+    std::fill_n(&reserve_face[0][0], sizeof(reserve_face), 0);
+    std::fill_n(&foundation[0][0], sizeof(foundation), 0);
+    std::fill_n(free_reserves, kLanes, 0);
+    std::fill_n(empty_cascades, kLanes, 0);
+    for (size_t b = 0; b < count; ++b) {
+      const SearchBoard &board = *(boards[b] = from[b]);
+      for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+        const Board::CascadeView cascade = board.cascade(i);
+        if (cascade.empty()) continue;
+        const Card back = cascade.back();
+        back_face[i][b] = back.face;
+        back_suit[i][b] = back.suit;
+        back_red[i][b] = back.color();
+        card_count_t n = 1;
+        while (n < cascade.size && tableau_stackable(
+                   cascade.card[cascade.size - n - 1],
+                   cascade.card[cascade.size - n])) {
+          ++n;
+        }
+        run[i][b] = n;
+      }
+      for (card_count_t j = 0; j < RESERVE_SIZE; ++j) {
+        const Card c = board.reserve[j];
+        reserve_face[j][b] = c.face;
+        reserve_suit[j][b] = c.suit;
+        reserve_red[j][b] = c.color();
+      }
+      for (card_count_t s = 0; s < 4; ++s) foundation[s][b] = board.foundation[s];
+      free_reserves[b] = board.count_free_reserves();
+      empty_cascades[b] = board.count_empty_cascades();
+    }
+  }
+  
+  /// Applies the rules to every lane. The loops over lanes are written to
+  /// vectorize: no branches, no gathers, nothing wider than a byte, and no
+  /// shifts, which x86 lacks for bytes. GCC vectorizes them at -O3 (or -O2
+  /// from GCC 12 on); -march=native lets it use the machine's widest vectors.
+  void find_moves() {
+    for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+      for (size_t b = 0; b < kLanes; ++b) {
+        const uint8_t room = free_reserves[b] + empty_cascades[b];
+        longest_move[i][b] = std::min<uint8_t>(run[i][b], room > 1 ? room : 1);
+      }
+    }
+    
+    for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+      for (size_t b = 0; b < kLanes; ++b) {
+        const uint8_t any = back_face[i][b] != 0;
+        cascade_to_reserve[i][b] = any & (free_reserves[b] != 0);
+        cascade_to_foundation[i][b] = any & (back_face[i][b]
+            == (uint8_t) (home(back_suit[i][b], b) + 1));
+      }
+      for (card_count_t j = 0; j < CASCADE_COUNT; ++j) {
+        for (size_t b = 0; b < kLanes; ++b) {
+          // Onto an empty cascade, a run of any length that may move will
+          // do; otherwise, just the one whose lead stacks on the back card.
+          // A lead of 0 wraps to 255 here, past any longest_move.
+          const uint8_t lead = back_face[j][b] - back_face[i][b];
+          const uint8_t lands = (back_face[j][b] == 0)
+              | (((uint8_t) (lead - 1) < longest_move[i][b])
+                 & ((back_red[j][b] ^ back_red[i][b]) == (lead & 1)));
+          cascade_to_cascade[i][j][b] = (back_face[i][b] != 0) & lands;
+        }
+      }
+      for (card_count_t r = 0; r < RESERVE_SIZE; ++r) {
+        for (size_t b = 0; b < kLanes; ++b) {
+          reserve_to_cascade[r][i][b] = (reserve_face[r][b] != 0)
+              & ((back_face[i][b] == 0)
+                 | (((uint8_t) (reserve_face[r][b] + 1) == back_face[i][b])
+                    & (reserve_red[r][b] != back_red[i][b])));
+        }
+      }
+      for (card_count_t s = 0; s < 4; ++s) {
+        // As in possible_moves(), never onto an empty cascade.
+        const uint8_t red = Card::color((Card::Suit) s);
+        for (size_t b = 0; b < kLanes; ++b) {
+          foundation_to_cascade[s][i][b] = (foundation[s][b] != 0)
+              & ((uint8_t) (foundation[s][b] + 1) == back_face[i][b])
+              & (red != back_red[i][b]);
+        }
+      }
+    }
+    for (card_count_t r = 0; r < RESERVE_SIZE; ++r) {
+      for (size_t b = 0; b < kLanes; ++b) {
+        reserve_to_foundation[r][b] = (reserve_face[r][b] != 0)
+            & (reserve_face[r][b] == (uint8_t) (home(reserve_suit[r][b], b)
+                                                + 1));
+      }
+    }
+  }
+  
+  /// Builds the children found, passing each to `take`.
+  template<typename F> void build(F &&take) const {
+    for (size_t b = 0; b < count; ++b) {
+      const SearchBoard &board = *boards[b];
+      for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+        for (card_count_t r = 0; r < RESERVE_SIZE; ++r) {
+          if (reserve_to_cascade[r][i][b]) {
+            take(reserve_to_tableau(board, r, i));
+          }
+        }
+        for (card_count_t j = 0; j < CASCADE_COUNT; ++j) {
+          if (!cascade_to_cascade[i][j][b]) continue;
+          if (back_face[j][b]) {
+            take(tableaux_move(board, i, j, back_face[j][b] - back_face[i][b]));
+            continue;
+          }
+          for (card_count_t n = 1; n <= longest_move[i][b]; ++n) {
+            take(tableaux_move(board, i, j, n));
+          }
+        }
+        if (cascade_to_reserve[i][b]) take(tableau_to_reserve(board, i));
+        if (cascade_to_foundation[i][b]) {
+          take(tableau_to_foundation(board, i));
+        }
+        for (card_count_t s = 0; s < 4; ++s) {
+          if (foundation_to_cascade[s][i][b]) {
+            take(foundation_to_tableau(board, s, i));
+          }
+        }
+      }
+      for (card_count_t r = 0; r < RESERVE_SIZE; ++r) {
+        if (reserve_to_foundation[r][b]) {
+          take(::reserve_to_foundation(board, r));
+        }
+      }
+    }
+  }
+  
+  /// Builds the children found and visits them, appending new boards to
+  /// `res`; whatever it held before stays.
+  void expand(MoveGraph &graph, Expansion &res) const {
+    build([&](SearchBoard &&child) { visit(res, std::move(child), graph); });
+  }
+  
+ private:
+  /// The height of a lane's foundation for a suit, picked out with masks
+  /// rather than a gather or a branch.
+  uint8_t home(uint8_t suit, size_t b) const {
+    return (foundation[0][b] & -(uint8_t) (suit == 0))
+         | (foundation[1][b] & -(uint8_t) (suit == 1))
+         | (foundation[2][b] & -(uint8_t) (suit == 2))
+         | (foundation[3][b] & -(uint8_t) (suit == 3));
+  }
+};
+
+/// Bytes the heap spends on each board in the move graph, beyond the board
+/// itself: the node's next pointer and cached hash, plus malloc's chunk header,
+/// all rounded up to malloc's 16-byte granularity. This matches glibc and
+/// libstdc++; other platforms will be in the same ballpark.
+constexpr size_t kGraphNodeBytes =
+    (sizeof(void*) + sizeof(SearchBoard) + 2 * sizeof(size_t) + 15) / 16 * 16;
+
+/// Counters and sizes describing one search, for capacity planning.
+struct SearchStats {
+  size_t expanded = 0;   ///< Boards popped from the queue and expanded.
+  size_t dropped = 0;    ///< Boards discarded from the queue to bound memory.
+  size_t generated = 0;  ///< Children produced by expansions.
+  size_t duplicates = 0; ///< Children that were already in the move graph.
+  size_t graph_size = 0, peak_graph = 0;
+  size_t queue_size = 0, peak_queue = 0, queue_capacity = 0;
+  size_t buckets = 0;
+  double load_factor = 0;
+  /// Probes of a NUMA-partitioned table from threads on the partition's own
+  /// node, and from threads on others.
+  size_t local_probes = 0, remote_probes = 0;
+  /// Boards a pipelined search expanded while a batch still in flight held a
+  /// better one, which search() would have expanded first.
+  size_t expanded_early = 0;
+  bool budget_exceeded = false; ///< The search gave up before finishing.
+  
+  void sample(const MoveGraph &graph, const SearchQueue &queue) {
+    graph_size = graph.size();
+    queue_size = queue.size();
+    peak_graph = std::max(peak_graph, graph_size);
+    peak_queue = std::max(peak_queue, queue_size);
+    queue_capacity = std::max(queue_capacity, queue.capacity());
+    buckets = graph.bucket_count();
+    load_factor = graph.load_factor();
+  }
+  
+  size_t payload_bytes() const { return peak_graph * sizeof(SearchBoard); }
+  size_t table_bytes() const {
+    return peak_graph * (kGraphNodeBytes - sizeof(SearchBoard))
+         + buckets * sizeof(void*);
+  }
+  size_t queue_bytes() const { return queue_capacity * sizeof(void*); }
+  size_t total_bytes() const {
+    return payload_bytes() + table_bytes() + queue_bytes();
+  }
+  
+  string memory_line() const {
+    std::ostringstream res;
+    res.setf(std::ios::fixed);
+    res.precision(1);
+    res << "Memory: graph " << graph_size << " boards, "
+        << (payload_bytes() + table_bytes()) / 1048576.0 << " MiB; queue "
+        << queue_size << " entries, " << queue_bytes() / 1048576.0
+        << " MiB; RSS " << proc_status_kb("VmRSS") / 1024.0 << " MiB (peak "
+        << proc_status_kb("VmHWM") / 1024.0 << " MiB)";
+    return res.str();
+  }
+  
+  string str() const {
+    std::ostringstream res;
+    res.setf(std::ios::fixed);
+    res.precision(2);
+    const double per_board = peak_graph ? 1.0 / peak_graph : 0;
+    res << "Search statistics:\n"
+        << "  Boards expanded:    " << expanded << "\n"
+        << "  Boards generated:   " << generated << " ("
+        << (generated ? 100.0 * duplicates / generated : 0)
+        << "% already in the graph)\n"
+        << "  Boards dropped:     " << dropped << "\n"
+        << "  Move graph:         " << graph_size << " boards (peak "
+        << peak_graph << "), " << buckets << " buckets, load factor "
+        << load_factor << "\n"
+        << "  Search queue:       " << queue_size << " entries (peak "
+        << peak_queue << "), capacity " << queue_capacity << "\n";
+    if (local_probes + remote_probes) {
+      res << "  Table probes:       " << local_probes << " local, "
+          << remote_probes << " remote ("
+          << 100.0 * remote_probes / (local_probes + remote_probes)
+          << "% on another NUMA node)\n";
+    }
+    if (expanded_early) {
+      res << "  Expanded early:     " << expanded_early << " ("
+          << 100.0 * expanded_early / expanded
+          << "% while a better board was in flight)\n";
+    }
+    res << "Bytes per board:\n"
+        << "  SearchBoard:        " << (double) sizeof(SearchBoard) << "\n"
+        << "  Hash table:         " << table_bytes() * per_board << "\n"
+        << "  Search queue:       " << queue_bytes() * per_board << "\n"
+        << "  Total:              " << total_bytes() * per_board << "\n"
+        << "Estimated peak heap:  " << total_bytes() / 1048576.0 << " MiB\n"
+        << "Process RSS:          " << proc_status_kb("VmRSS") / 1024.0
+        << " MiB (peak " << proc_status_kb("VmHWM") / 1024.0 << " MiB)\n";
+    return res.str();
+  }
+  
+  string json() const {
+    std::ostringstream res;
+    res << "{\"expanded\": " << expanded << ", \"generated\": " << generated
+        << ", \"duplicates\": " << duplicates << ", \"dropped\": " << dropped
+        << ", \"graph_size\": " << graph_size
+        << ", \"peak_graph\": " << peak_graph
+        << ", \"queue_size\": " << queue_size
+        << ", \"peak_queue\": " << peak_queue
+        << ", \"queue_capacity\": " << queue_capacity
+        << ", \"buckets\": " << buckets
+        << ", \"load_factor\": " << load_factor
+        << ", \"local_probes\": " << local_probes
+        << ", \"remote_probes\": " << remote_probes
+        << ", \"expanded_early\": " << expanded_early
+        << ", \"bytes_per_board\": {\"payload\": " << sizeof(SearchBoard)
+        << ", \"table\": " << (peak_graph ? table_bytes() / peak_graph : 0)
+        << ", \"queue\": " << (peak_graph ? queue_bytes() / peak_graph : 0)
+        << "}, \"peak_heap_bytes\": " << total_bytes()
+        << ", \"peak_rss_kb\": " << proc_status_kb("VmHWM") << "}";
+    return res.str();
+  }
+};
+
+/// Set from a signal handler to ask the running search to describe itself.
+/// Only this flag is touched in the handler; the search loop does the rest.
+std::atomic<bool> search_dump_requested {false};
+static_assert(std::atomic<bool>::is_always_lock_free);
+
+extern "C" void request_search_dump(int) {
+  search_dump_requested.store(true, std::memory_order_relaxed);
+}
+
+/// Describes a search in progress on stderr: its counters and memory use, as
+/// far as `stats` has them, the most complete board so far, the board it will
+/// expand next, and how deep the boards in its `frontier` are.
+template<typename Boards>
+void dump_search_state(const SearchStats &stats, const Boards &frontier,
+                       const char *frontier_name, const SearchBoard *best,
+                       const SearchBoard *next, size_t expanded,
+                       Clock::time_point start) {
+  const double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  std::ostringstream res;
+  res << "\n=== Search state after " << elapsed << " s ===\n"
+      << "Expanded " << expanded << " boards ("
+      << (elapsed ? expanded / elapsed : 0) << " per second); "
+      << stats.graph_size << " in the graph, " << frontier.size()
+      << " in the " << frontier_name << ".\n"
+      << stats.memory_line() << "\n";
+  if (best) {
+    res << "\nMost complete board (" << best->completion() << "%, "
+        << best->num_moves() << " moves deep, heuristic=" << best->heuristic
+        << "):\n" << best->inflate().str();
+  }
+  if (next) {
+    res << "\nNext board to expand (" << next->num_moves()
+        << " moves deep, heuristic=" << next->heuristic << "):\n"
+        << next->inflate().str();
+  }
+  
+  std::map<unsigned, size_t> depths;
+  constexpr unsigned kBin = 10;
+  for (const SearchBoard *b : frontier) ++depths[b->depth / kBin];
+  size_t widest = 0;
+  for (auto &d : depths) widest = std::max(widest, d.second);
+  res << "\nFrontier by depth:\n";
+  for (auto &d : depths) {
+    char label[48];
+    snprintf(label, sizeof(label), "  %4u - %4u %9zu ", d.first * kBin,
+             d.first * kBin + kBin - 1, d.second);
+    res << label << string(widest ? d.second * 50 / widest : 0, '#') << "\n";
+  }
+  cerr << res.str() << endl;
+}
+
+/// Describes a best-first search in progress, whose frontier is its queue.
+void dump_search_state(SearchQueue &search, const MoveGraph &move_graph,
+                       const SearchBoard *best, size_t expanded,
+                       Clock::time_point start) {
+  SearchStats stats;
+  stats.sample(move_graph, search);
+  dump_search_state(stats, search.entries(), "queue", best,
+                    search.empty() ? nullptr : search.top(), expanded, start);
+}
+
+/// How a search should behave, beyond the heuristic weights.
+struct SolveOptions {
+  bool verbose = true;         ///< Print progress as the search runs.
+  bool report_memory = false;  ///< Print a memory summary about once a second.
+  size_t max_expansions = 0;   ///< Give up after expanding this many boards.
+  double max_seconds = 0;      ///< Give up after searching this long.
+  size_t max_bytes = 0;        ///< Give up once the search holds this much.
+  size_t beam_width = 0;       ///< Search in layers this wide; 0 searches
+                               ///< best-first.
+  bool pipeline = false;       ///< Expand boards in stages on several threads.
+  unsigned pipeline_jobs = 16; ///< Batches a pipelined search keeps in
+                               ///< flight, up to PipelineSearch::kMaxJobs.
+  unsigned pipeline_boards = 4; ///< Boards in each of those batches, up to
+                               ///< BoardBatch::kLanes.
+  bool ida = false;            ///< Search by iterative deepening instead.
+  bool affinity = false;       ///< Pin an iterative deepening search's
+                               ///< threads to CPUs, spread over the NUMA
+                               ///< nodes. The other searches ignore it.
+  unsigned first_cpu = 0;      ///< With `affinity`, where this search's
+                               ///< threads start in the order CPUs are
+                               ///< handed out, so that searches running at
+                               ///< once don't pin to the same ones.
+  bool deterministic = false;  ///< Make a parallel search's result and work
+                               ///< the same from run to run.
+  unsigned threads = 1;        ///< Threads a beam or iterative deepening
+                               ///< search may split its work over.
+};
+
+/// Buffers a search can borrow instead of allocating its own, so that one
+/// search after another can run without going back to the heap.
+struct SearchScratch {
+  SearchQueue queue;
+  Expansion expansion;
+};
+
+/// Runs the search proper, returning the winning board, or null if none.
+/// The returned board lives in (and dies with) the given move graph.
+const SearchBoard *search(const Board &game, MoveGraph &move_graph,
+                          const SolveOptions &options,
+                          SearchStats *stats = nullptr,
+                          SearchScratch *scratch = nullptr) {
+  SearchScratch local;
+  if (!scratch) scratch = &local;
+  SearchQueue &search = scratch->queue;
+  search.clear();
+  const Clock::time_point start = Clock::now();
+  Clock::time_point last_report = start;
+  const bool verbose = options.verbose;
+  
+  auto ins = move_graph.insert(SearchBoard { game });
+  search.push(&*ins.first);
+  if (search_trace) search_trace->record(TraceRecord::NEW, *ins.first);
+  
+  int bno = 0, ino = 0;
+  
+  int compp = 0;
+  size_t freed_results = 0;
+  bool budget_exceeded = false;
+  const SearchBoard *best = nullptr;
+  if (search_perf) search_perf->start_loop();
+  while (!search.empty()) {
+    const SearchBoard &board = *search.top();
+    const int comp = board.completion();
+    const int nmoves = board.num_moves();
+    if (!best || comp > best->completion()) best = &board;
+    if (search_dump_requested.load(std::memory_order_relaxed)
+        && search_dump_requested.exchange(false)) {
+      dump_search_state(search, move_graph, best, ino, start);
+    }
+    if (board.is_won()) {
+      if (search_perf) search_perf->stop_loop();
+      if (stats) stats->sample(move_graph, search);
+      if (verbose) cout << endl << "Solution found." << endl << endl;
+      if (search_trace) {
+        vector<const SearchBoard*> path;
+        for (const SearchBoard *b = &board; b; b = b->previous) path.push_back(b);
+        for (auto b = path.rbegin(); b != path.rend(); ++b) {
+          search_trace->record(TraceRecord::SOLUTION, **b);
+        }
+      }
+      return &board;
+    }
+    if ((options.max_expansions && (size_t) ino >= options.max_expansions)
+        || (options.max_seconds && !(ino & 0x3FF) && ino
+            && std::chrono::duration<double>(Clock::now() - start).count()
+                   > options.max_seconds)
+        || (options.max_bytes
+            && move_graph.size() * kGraphNodeBytes
+               + (move_graph.bucket_count() + search.capacity()) * sizeof(void*)
+               > options.max_bytes)) {
+      budget_exceeded = true;
+      break;
+    }
+    if (search_trace) search_trace->record(TraceRecord::EXPAND, board);
+    const bool sample_perf =
+        search_perf && !(ino % PerfCounters::kSampleInterval);
+    if (sample_perf) search_perf->sample(true);
+    Expansion &moves = scratch->expansion;
+    possible_moves(board, move_graph, moves);
+    if (sample_perf) search_perf->sample(false);
+    search.pop();
+    for (auto &move : moves.children) {
+      if (!(++bno & 0xFFFF) && verbose) {
+        cout << "\nArbitrary board (heuristic=" << move->heuristic << "):\n"
+             << move->inflate().str() << endl << endl;
+      }
+      search.push(std::move(move));
+    }
+    if ((!(ino++ & 0x1FF) || comp > compp) && verbose) {
+      cout << "Searched " << ino << " boards [" << search.size()
+           << ":" << move_graph.size() << "]; " << nmoves
+           << " moves deep; maybe " << comp << "% complete...\r";
+      compp = comp;
+      if (stats && options.report_memory
+          && Clock::now() - last_report > std::chrono::seconds(1)) {
+        stats->sample(move_graph, search);
+        cout << endl << stats->memory_line() << endl;
+        last_report = Clock::now();
+      }
+    }
+    if (stats) {
+      ++stats->expanded;
+      stats->generated += moves.children.size() + moves.duplicates;
+      stats->duplicates += moves.duplicates;
+      stats->peak_queue = std::max(stats->peak_queue, search.size());
+    }
+    while (search.size() > GC_UPPER_BOUND) {
+      if (search_trace) search_trace->record(TraceRecord::DROP, *search.back());
+      search.pop_back();
+      ++freed_results;
+    }
+  }
+  if (search_perf) search_perf->stop_loop();
+  if (stats) {
+    stats->sample(move_graph, search);
+    stats->dropped = freed_results;
+    stats->budget_exceeded = budget_exceeded;
+  }
+  if (!verbose) return nullptr;
+  if (budget_exceeded) {
+    cout << endl << "Search budget exceeded after " << ino << " boards."
+         << endl << endl;
+  } else if (freed_results) {
+    cout << endl << "Search space exhausted (but " << freed_results
+         << " were collected due to memory limitations)." << endl << endl;
+  } else {
+    cout << endl << "Search space exhausted." << endl << endl;
+  }
+  return nullptr;
+}
+
+/// The machine's NUMA nodes and the CPUs on each, as sysfs lists them, less
+/// any CPUs this process may not run on. Where sysfs says nothing, as in some
+/// containers and on other platforms, the whole machine is one node.
+class NumaTopology {
+ public:
+  static const NumaTopology &get() {
+    static const NumaTopology topology;
+    return topology;
+  }
+  
+  unsigned nodes() const { return node_cpus.size(); }
+  
+  /// The node a team's thread `t` runs on when pinned: threads are dealt out
+  /// to the nodes in turn, so that a team of any size spans them all.
+  unsigned node_of_thread(unsigned t) const { return t % nodes(); }
+  
+  /// The node of the CPU the calling thread happens to be on right now.
+  unsigned current_node() const {
+#   ifdef __linux__
+    const int cpu = sched_getcpu();
+    if (cpu >= 0 && (size_t) cpu < cpu_node.size()) return cpu_node[cpu];
+#   endif
+    return 0;
+  }
+  
+  /// Pins the calling thread to the CPU for a team's thread `t`.
+  void pin(unsigned t) const {
+#   ifdef __linux__
+    const vector<int> &cpus = node_cpus[node_of_thread(t)];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[t / nodes() % cpus.size()], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#   endif
+  }
+  
+  /// Returns `bytes` of zeroed memory whose pages prefer to live on `node`,
+  /// or null; give it back with unmap(). The preference is only a hint to
+  /// the kernel, and is silently dropped where it can't be given.
+  void *map_on_node(size_t bytes, unsigned node) const {
+#   ifdef __linux__
+    void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+    if (nodes() > 1 && node_ids[node] < 64) {
+      const unsigned long mask = 1ul << node_ids[node];
+      syscall(SYS_mbind, p, bytes, MPOL_PREFERRED, &mask, 64, 0);
+    }
+    return p;
+#   else
+    return calloc(1, bytes);
+#   endif
+  }
+  
+  static void unmap(void *p, size_t bytes) {
+#   ifdef __linux__
+    if (p) munmap(p, bytes);
+#   else
+    free(p);
+#   endif
+  }
+  
+ private:
+  vector<vector<int>> node_cpus;
+  vector<unsigned> node_ids;  ///< The kernel's number for each node.
+  vector<unsigned> cpu_node;  ///< Our index of each CPU's node.
+  
+  NumaTopology() {
+#   ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) CPU_ZERO(&allowed);
+    const string sys = "/sys/devices/system/node/";
+    for (int id : read_cpu_list(sys + "online")) {
+      vector<int> cpus;
+      for (int cpu : read_cpu_list(sys + "node" + std::to_string(id)
+                                   + "/cpulist")) {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+      }
+      if (cpus.empty()) continue;
+      for (int cpu : cpus) {
+        if (cpu_node.size() <= (size_t) cpu) cpu_node.resize(cpu + 1);
+        cpu_node[cpu] = node_cpus.size();
+      }
+      node_cpus.push_back(cpus);
+      node_ids.push_back(id);
+    }
+    if (!node_cpus.empty()) return;
+    node_cpus.emplace_back();
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) node_cpus[0].push_back(cpu);
+    }
+#   endif
+    if (node_cpus.empty()) node_cpus.emplace_back();
+    if (node_cpus[0].empty()) node_cpus[0].push_back(0);
+    node_ids.assign(1, 0);
+    cpu_node.clear();
+  }
+  
+  /// Reads a list like "0-3,8-11", as sysfs writes them.
+  static vector<int> read_cpu_list(const string &fname) {
+    vector<int> res;
+    std::ifstream in(fname);
+    string list;
+    if (!std::getline(in, list)) return res;
+    std::istringstream ranges(list);
+    for (string range; std::getline(ranges, range, ','); ) {
+      int first, last;
+      const int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+      if (n < 1) continue;
+      if (n < 2) last = first;
+      for (int i = first; i <= last; ++i) res.push_back(i);
+    }
+    return res;
+  }
+};
+
+/// Pins the calling thread, as NumaTopology::pin() does, for as long as this
+/// lives, then lets it run anywhere it could before. Does nothing unless
+/// `enabled`, so callers can pin or not as the user asked.
+class ThreadPin {
+ public:
+  ThreadPin(bool enabled, unsigned t): enabled(enabled) {
+#   ifdef __linux__
+    if (!enabled) return;
+    if (sched_getaffinity(0, sizeof(saved), &saved)) this->enabled = false;
+    else NumaTopology::get().pin(t);
+#   endif
+  }
+  ThreadPin(const ThreadPin&) = delete;
+  ~ThreadPin() {
+#   ifdef __linux__
+    if (enabled) sched_setaffinity(0, sizeof(saved), &saved);
+#   endif
+  }
+  
+ private:
+  bool enabled;
+# ifdef __linux__
+  cpu_set_t saved;
+# endif
+};
+
+/// A fixed team of threads that run one function together: run(f) calls f(0)
+/// on the calling thread and f(1) through f(size() - 1) on the others, and
+/// returns once all of them have. A pinned team keeps each thread on its own
+/// CPU, spread over the NUMA nodes, thread t taking NumaTopology::pin()'s
+/// CPU for `first_cpu + t`. That includes the thread that makes the team,
+/// which must be the one calling run(), for as long as the team lives. With
+/// --chrome-trace, the other threads are named after the team.
+class WorkerTeam {
+ public:
+  explicit WorkerTeam(unsigned size, const char *name, bool pinned = false,
+                      unsigned first_cpu = 0):
+      name(name), pinned(pinned), first_cpu(first_cpu),
+      pin(pinned, first_cpu) {
+    for (unsigned t = 1; t < size; ++t) {
+      threads.emplace_back([this, t] { work(t); });
+    }
+  }
+  WorkerTeam(const WorkerTeam&) = delete;
+  
+  ~WorkerTeam() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      ++generation;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads) t.join();
+  }
+  
+  unsigned size() const { return threads.size() + 1; }
+  
+  /// Runs `f` on every thread. Given a `span` name, and --chrome-trace, each
+  /// thread's share of the work is traced as a span of that name.
+  template<typename F> void run(F &&f, const char *span = nullptr) {
+    if (!span || !chrome_trace) return dispatch(f);
+    dispatch([&](unsigned t) {
+      const Clock::time_point start = Clock::now();
+      f(t);
+      chrome_trace->complete(span, name, start, Clock::now());
+    });
+  }
+  
+ private:
+  const char *const name;
+  const bool pinned;
+  const unsigned first_cpu;
+  ThreadPin pin;
+  vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake, finished;
+  void (*call)(void*, unsigned) = nullptr;
+  void *context = nullptr;
+  size_t pending = 0;
+  uint64_t generation = 0;
+  bool stopping = false;
+  
+  template<typename F> void dispatch(F &&f) {
+    if (threads.empty()) return f(0);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      typedef typename std::remove_reference<F>::type Function;
+      call = [](void *f, unsigned t) { (*(Function*) f)(t); };
+      context = (void*) &f;
+      pending = threads.size();
+      ++generation;
+    }
+    wake.notify_all();
+    f(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return !pending; });
+  }
+  
+  void work(unsigned t) {
+    ThreadPin pin(pinned, first_cpu + t);
+    if (chrome_trace) {
+      chrome_trace->name_thread(string(name) + " " + std::to_string(t));
+    }
+    for (uint64_t seen = 0; ; ) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return generation != seen; });
+        seen = generation;
+        if (stopping) return;
+      }
+      call(context, t);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!--pending) finished.notify_one();
+    }
+  }
+};
+
+/// A child found in a layer of the beam, by where it came from: `origin` is
+/// its parent's place in the beam and the order the parent's moves made it
+/// in, which breaks every tie the same way however the work was divided.
+struct BeamCandidate {
+  uint64_t hash;
+  uint64_t origin;
+  uint32_t worker, index; ///< Where the child itself is kept.
+};
+
+/// Sorts candidates by hash, a byte per pass, least significant first. Each
+/// pass counts digits, then scatters, with the team splitting the candidates
+/// between them. `spare` is the other buffer.
+void radix_sort_by_hash(WorkerTeam &team, vector<BeamCandidate> &keys,
+                        vector<BeamCandidate> &spare,
+                        vector<std::array<size_t, 256>> &counts) {
+  const unsigned workers = team.size();
+  const size_t n = keys.size();
+  spare.resize(n);
+  counts.resize(workers);
+  for (unsigned shift = 0; shift < 64; shift += 8) {
+    team.run([&](unsigned t) {
+      std::array<size_t, 256> &count = counts[t];
+      count.fill(0);
+      for (size_t i = n * t / workers; i < n * (t + 1) / workers; ++i) {
+        ++count[keys[i].hash >> shift & 0xFF];
+      }
+    }, "radix count");
+    // Every candidate having the same digit here leaves them as they are.
+    bool uniform = false;
+    size_t sum = 0;
+    for (unsigned d = 0; d < 256; ++d) {
+      size_t digit_total = 0;
+      for (unsigned t = 0; t < workers; ++t) {
+        const size_t c = counts[t][d];
+        counts[t][d] = sum;
+        sum += c;
+        digit_total += c;
+      }
+      uniform |= digit_total == n;
+    }
+    if (uniform) continue;
+    team.run([&](unsigned t) {
+      std::array<size_t, 256> &next = counts[t];
+      for (size_t i = n * t / workers; i < n * (t + 1) / workers; ++i) {
+        spare[next[keys[i].hash >> shift & 0xFF]++] = keys[i];
+      }
+    }, "radix scatter");
+    keys.swap(spare);
+  }
+}
+
+/// Searches in layers, keeping only the `beam_width` most promising boards of
+/// each. Uses far less memory than search(), but may miss a solution that
+/// search() would find. Each layer is split between `options.threads`
+/// threads. They expand disjoint slices of the beam, a batch at a time. Then
+/// a radix sort on hashes brings duplicate children together, and each thread
+/// picks the best of its share of the survivors. The result is the same
+/// however many threads there are.
+const SearchBoard *beam_search(const Board &game, MoveGraph &move_graph,
+                               const SolveOptions &options,
+                               SearchStats *stats = nullptr) {
+  struct Worker {
+    BoardBatch batch;
+    vector<SearchBoard> built;
+    vector<BeamCandidate> found;
+    vector<const BeamCandidate*> best;
+    size_t duplicates = 0;
+  };
+  
+  const Clock::time_point start = Clock::now();
+  const bool verbose = options.verbose;
+  WorkerTeam team(std::max(1u, options.threads), "beam");
+  const unsigned workers = team.size();
+  vector<Worker> work(workers);
+  vector<const SearchBoard*> beam;
+  beam.push_back(&*move_graph.insert(SearchBoard { game }).first);
+  vector<BeamCandidate> layer, spare;
+  vector<std::array<size_t, 256>> counts;
+  vector<const BeamCandidate*> best;
+  size_t expanded = 0;
+  bool budget_exceeded = false;
+  
+  // The order in which to keep children: most promising first, and after that,
+  // whatever is fixed by the boards and their origins.
+  auto better = [](const SearchBoard &a, const BeamCandidate *ka,
+                   const SearchBoard &b, const BeamCandidate *kb) {
+    if (a.heuristic != b.heuristic) return a.heuristic > b.heuristic;
+    if (ka->hash != kb->hash) return ka->hash < kb->hash;
+    return ka->origin < kb->origin;
+  };
+  auto board_of = [&](const BeamCandidate *k) -> SearchBoard& {
+    return work[k->worker].built[k->index];
+  };
+  auto better_key = [&](const BeamCandidate *a, const BeamCandidate *b) {
+    return better(board_of(a), a, board_of(b), b);
+  };
+  
+  for (size_t depth = 0; !beam.empty(); ++depth) {
+    for (const SearchBoard *board : beam) {
+      if (!board->is_won()) continue;
+      if (stats) stats->graph_size = stats->peak_graph = move_graph.size();
+      if (verbose) cout << endl << "Solution found." << endl << endl;
+      return board;
+    }
+    if ((options.max_expansions && expanded >= options.max_expansions)
+        || (options.max_seconds
+            && std::chrono::duration<double>(Clock::now() - start).count()
+                   > options.max_seconds)
+        || (options.max_bytes
+            && move_graph.size() * kGraphNodeBytes
+               + move_graph.bucket_count() * sizeof(void*) > options.max_bytes)) {
+      budget_exceeded = true;
+      break;
+    }
+    if (search_dump_requested.load(std::memory_order_relaxed)
+        && search_dump_requested.exchange(false)) {
+      // The layer about to be expanded is the frontier; the graph stands
+      // still between layers.
+      SearchStats state;
+      state.sample(move_graph, SearchQueue());
+      state.queue_size = beam.size();
+      state.queue_capacity = beam.capacity();
+      const SearchBoard *most_complete = *std::max_element(
+          beam.begin(), beam.end(),
+          [](const SearchBoard *a, const SearchBoard *b) {
+            return a->completion() < b->completion();
+          });
+      dump_search_state(state, beam, "beam", most_complete, beam.front(),
+                        expanded, start);
+    }
+    
+    const Clock::time_point layer_start = Clock::now();
+    const size_t expanding = beam.size();
+    expanded += expanding;
+    
+    // Expand: each worker takes every so many batches of the beam, and drops
+    // children already in the graph, which nobody is changing just now.
+    const size_t batches = (beam.size() + BoardBatch::kLanes - 1)
+                         / BoardBatch::kLanes;
+    team.run([&](unsigned t) {
+      Worker &w = work[t];
+      w.built.clear();
+      w.found.clear();
+      w.duplicates = 0;
+      for (size_t b = t; b < batches; b += workers) {
+        const size_t first = b * BoardBatch::kLanes;
+        w.batch.load(&beam[first], beam.size() - first);
+        w.batch.find_moves();
+        size_t parent = first, ordinal = 0;
+        w.batch.build([&](SearchBoard &&child) {
+          if (beam[parent] != child.previous) {
+            while (beam[parent] != child.previous) ++parent;
+            ordinal = 0;
+          }
+          const uint64_t origin = (uint64_t) parent << 16 | ordinal++;
+          if (move_graph.count(child)) {
+            ++w.duplicates;
+            return;
+          }
+          child.heuristic = child.calc_heuristic();
+          w.found.push_back({ SearchBoard::Hash()(child), origin, t,
+                              (uint32_t) w.built.size() });
+          w.built.push_back(std::move(child));
+        });
+      }
+    }, "expand");
+    
+    layer.clear();
+    size_t duplicates = 0;
+    for (Worker &w : work) {
+      layer.insert(layer.end(), w.found.begin(), w.found.end());
+      duplicates += w.duplicates;
+    }
+    const size_t generated = layer.size() + duplicates;
+    radix_sort_by_hash(team, layer, spare, counts);
+    
+    // Each worker takes a share of the sorted children, starting and ending
+    // on a change of hash, keeps the first-found of each set of equal boards,
+    // and picks out its best.
+    const size_t n = layer.size(), width = options.beam_width;
+    std::atomic<size_t> same_board {0};
+    team.run([&](unsigned t) {
+      auto boundary = [&](size_t i) {
+        while (i && i < n && layer[i].hash == layer[i - 1].hash) ++i;
+        return i;
+      };
+      const size_t lo = boundary(n * t / workers);
+      const size_t hi = boundary(n * (t + 1) / workers);
+      vector<const BeamCandidate*> &mine = work[t].best;
+      mine.clear();
+      size_t dropped = 0;
+      for (size_t i = lo; i < hi; ++i) {
+        bool first = true;
+        for (size_t j = i; j-- > lo && layer[j].hash == layer[i].hash; ) {
+          first &= !(SearchBoard::BasicallyEqual()(board_of(&layer[j]),
+                                                   board_of(&layer[i]))
+                     && layer[j].origin < layer[i].origin);
+        }
+        for (size_t j = i + 1; j < hi && layer[j].hash == layer[i].hash; ++j) {
+          first &= !(SearchBoard::BasicallyEqual()(board_of(&layer[j]),
+                                                   board_of(&layer[i]))
+                     && layer[j].origin < layer[i].origin);
+        }
+        if (first) mine.push_back(&layer[i]);
+        else ++dropped;
+      }
+      same_board += dropped;
+      if (mine.size() > width) {
+        std::nth_element(mine.begin(), mine.begin() + width, mine.end(),
+                         better_key);
+        mine.resize(width);
+      }
+    }, "select");
+    
+    best.clear();
+    for (Worker &w : work) best.insert(best.end(), w.best.begin(), w.best.end());
+    const size_t keep = std::min(best.size(), width);
+    std::nth_element(best.begin(), best.begin() + keep, best.end(), better_key);
+    best.resize(keep);
+    std::sort(best.begin(), best.end(), better_key);
+    
+    beam.clear();
+    for (const BeamCandidate *k : best) {
+      SearchBoard &child = board_of(k);
+      child.id = move_graph.size();
+      beam.push_back(&*move_graph.insert(std::move(child)).first);
+    }
+    if (stats) {
+      stats->expanded += expanding;
+      stats->generated += generated;
+      stats->duplicates += duplicates + same_board;
+      stats->dropped += n - same_board - keep;
+    }
+    if (chrome_trace) {
+      chrome_trace->complete("layer " + std::to_string(depth + 1), "beam",
+          layer_start, Clock::now(), "\"expanded\": "
+          + std::to_string(expanding) + ", \"generated\": "
+          + std::to_string(generated) + ", \"kept\": " + std::to_string(keep));
+    }
+    if (verbose) {
+      cout << "Layer " << depth + 1 << ": " << beam.size() << " boards ["
+           << move_graph.size() << "]; best heuristic "
+           << (beam.empty() ? 0 : beam.front()->heuristic) << "...\r";
+    }
+  }
+  if (stats) {
+    stats->graph_size = stats->peak_graph = move_graph.size();
+    stats->buckets = move_graph.bucket_count();
+    stats->load_factor = move_graph.load_factor();
+    stats->budget_exceeded = budget_exceeded;
+  }
+  if (verbose) {
+    cout << endl << (budget_exceeded ? "Search budget exceeded"
+                                     : "Beam ran dry") << " after "
+         << expanded << " boards." << endl << endl;
+  }
+  return nullptr;
+}
+
+/// Searches best-first like search(), with the work of expanding boards split
+/// into stages, each on a thread of its own and handed along by bounded rings:
+/// finding moves, building the children, inserting them into the move graph,
+/// and scoring the new ones. The queue stays with the calling thread, which
+/// keeps a window of batches of boards in flight. It takes results back in the
+/// order it sent them, and only the oldest batch's, so which boards get
+/// expanded never depends on the threads' timing. Once a board is in the
+/// graph, other stages may be reading it, so unlike search(), this never
+/// re-parents a board onto a shorter path.
+///
+/// Boards popped while earlier batches are still in flight are chosen without
+/// those batches' children, so the wider the window, the more boards search()
+/// would never have expanded. A stage with nothing to do sleeps until its
+/// ring has a job, rather than spinning for the cores the others need.
+class PipelineSearch {
+ public:
+  static constexpr size_t kMaxJobs = 256; ///< Most batches in flight.
+  static constexpr unsigned kThreads = 5; ///< The driver and four stages.
+  
+  PipelineSearch(MoveGraph &graph, const SolveOptions &options):
+      graph(graph),
+      window(std::min<size_t>(std::max(1u, options.pipeline_jobs), kMaxJobs)),
+      batch(std::min<size_t>(std::max(1u, options.pipeline_boards),
+                             BoardBatch::kLanes)),
+      jobs(window) {}
+  
+  const SearchBoard *run(const Board &game, const SolveOptions &options,
+                         SearchStats *stats) {
+    std::thread stages[] = {
+      stage("find moves", to_find, to_build, [](Job &job) {
+        job.batch.load(job.parents, job.count);
+        job.batch.find_moves();
+      }),
+      stage("build", to_build, to_insert, [](Job &job) {
+        job.built.clear();
+        job.batch.build([&](SearchBoard &&child) {
+#         if SANITY_CHECKS
+            if (sanity_interval && !sanity_countdown--) {
+              sanity_countdown = sanity_interval - 1;
+              child.check_sanity();
+            }
+#         endif
+          job.built.push_back(std::move(child));
+        });
+      }),
+      stage("insert", to_insert, to_score, [this](Job &job) {
+        job.fresh.clear();
+        job.duplicates = 0;
+        for (SearchBoard &child : job.built) {
+          child.id = graph.size();
+          auto ins = graph.insert(std::move(child));
+          if (ins.second) job.fresh.push_back(&*ins.first);
+          else ++job.duplicates;
+        }
+      }),
+      stage("score", to_score, done, [](Job &job) {
+        for (const SearchBoard *b : job.fresh) b->heuristic = b->calc_heuristic();
+      }),
+    };
+    const SearchBoard *won = drive(game, options, stats);
+    pass(to_find, kStop);
+    while (take(done) != kStop) {}
+    for (std::thread &t : stages) t.join();
+    if (stats) stats->sample(graph, queue);
+    return won;
+  }
+  
+ private:
+  struct Job {
+    const SearchBoard *parents[BoardBatch::kLanes];
+    bool early[BoardBatch::kLanes]; ///< Parents counted as expanded early.
+    size_t count = 0;
+    BoardBatch batch;
+    vector<SearchBoard> built;
+    vector<const SearchBoard*> fresh;
+    size_t duplicates = 0;
+  };
+  static constexpr uint32_t kStop = UINT32_MAX;
+  /// Times to look for a job, yielding in between, before going to sleep.
+  static constexpr unsigned kSpins = 16;
+  
+  /// A ring of job numbers whose reader sleeps while it is empty. It has
+  /// room for every job and a stop, so passing a job never waits.
+  struct Ring {
+    SpscRing<uint32_t, 2 * kMaxJobs> jobs;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::atomic<bool> sleeping {false};
+  };
+  
+  MoveGraph &graph;
+  const size_t window, batch;
+  SearchQueue queue;
+  vector<Job> jobs;
+  Ring to_find, to_build, to_insert, to_score, done;
+  
+  static void pass(Ring &ring, uint32_t job) {
+    ring.jobs.try_push(job);
+    // Either the reader sees the job before it sleeps, or this sees it
+    // sleeping and wakes it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring.sleeping.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(ring.mutex);
+      ring.ready.notify_one();
+    }
+  }
+  static uint32_t take(Ring &ring) {
+    uint32_t job;
+    for (unsigned i = 0; i < kSpins; ++i) {
+      if (ring.jobs.try_pop(job)) return job;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(ring.mutex);
+    ring.sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    ring.ready.wait(lock, [&] { return ring.jobs.try_pop(job); });
+    ring.sleeping.store(false, std::memory_order_relaxed);
+    return job;
+  }
+  
+  /// Starts the pipeline's thread for a stage, running `work` on each job.
+  /// With --chrome-trace, each job's trip through the stage is a span.
+  template<typename F>
+  std::thread stage(const char *name, Ring &in, Ring &out, F work) {
+    return std::thread([this, name, &in, &out, work] {
+      if (chrome_trace) chrome_trace->name_thread(string("pipeline ") + name);
+      for (uint32_t job; (job = take(in)) != kStop; pass(out, job)) {
+        const Clock::time_point start = Clock::now();
+        work(jobs[job]);
+        if (chrome_trace) {
+          chrome_trace->complete(name, "pipeline", start, Clock::now(),
+              "\"job\": " + std::to_string(job) + ", \"boards\": "
+              + std::to_string(jobs[job].count));
+        }
+      }
+      pass(out, kStop);
+    });
+  }
+  
+  /// Runs the queue, feeding batches to the stages and taking back results.
+  const SearchBoard *drive(const Board &game, const SolveOptions &options,
+                           SearchStats *stats) {
+    const Clock::time_point start = Clock::now();
+    const bool verbose = options.verbose;
+    queue.push(&*graph.insert(SearchBoard { game }).first);
+    size_t sent = 0, received = 0, expanded = 0, dropped = 0, early = 0;
+    size_t nodes = 1; // The graph's size, as of the last batch taken back.
+    bool budget_exceeded = false;
+    const SearchBoard *won = nullptr, *most_complete = nullptr;
+    for (;;) {
+      while (sent - received < window && !queue.empty()) {
+        const SearchBoard *top = queue.top();
+        if (top->is_won()) {
+          won = top;
+          break;
+        }
+        if ((options.max_expansions && expanded >= options.max_expansions)
+            || (options.max_seconds && !(sent & 0xFF) && sent
+                && std::chrono::duration<double>(Clock::now() - start).count()
+                       > options.max_seconds)
+            || (options.max_bytes
+                && nodes * kGraphNodeBytes + queue.capacity() * sizeof(void*)
+                   > options.max_bytes)) {
+          budget_exceeded = true;
+          break;
+        }
+        Job &job = jobs[sent % window];
+        job.count = 0;
+        while (job.count < batch && !queue.empty()
+               && !queue.top()->is_won()) {
+          const SearchBoard *parent = queue.top();
+          if (!most_complete
+              || parent->completion() > most_complete->completion()) {
+            most_complete = parent;
+          }
+          job.early[job.count] = false;
+          job.parents[job.count++] = parent;
+          queue.pop();
+        }
+        if (!job.count) continue;
+        expanded += job.count;
+        pass(to_find, sent++ % window);
+      }
+      if (won || budget_exceeded || sent == received) break;
+      
+      const Job &job = jobs[take(done)];
+      ++received;
+      nodes += job.fresh.size();
+      int best = INT_MIN;
+      for (const SearchBoard *child : job.fresh) {
+        queue.push(child);
+        best = std::max(best, child->heuristic);
+      }
+      // Parents sent since this batch, and worse than its best child, went
+      // ahead of a board search() would have taken first.
+      for (size_t k = received; k < sent; ++k) {
+        Job &later = jobs[k % window];
+        for (size_t i = 0; i < later.count; ++i) {
+          if (later.early[i] || later.parents[i]->heuristic >= best) continue;
+          later.early[i] = true;
+          ++early;
+        }
+      }
+      while (queue.size() > GC_UPPER_BOUND) {
+        queue.pop_back();
+        ++dropped;
+      }
+      if (stats) {
+        stats->expanded += job.count;
+        stats->generated += job.fresh.size() + job.duplicates;
+        stats->duplicates += job.duplicates;
+        stats->peak_queue = std::max(stats->peak_queue, queue.size());
+      }
+      if (search_dump_requested.load(std::memory_order_relaxed)
+          && search_dump_requested.exchange(false)) {
+        // The insert stage may be growing the graph, so go by the count
+        // taken back rather than look at it.
+        SearchStats state;
+        state.graph_size = state.peak_graph = nodes;
+        state.queue_size = queue.size();
+        state.queue_capacity = queue.capacity();
+        dump_search_state(state, queue.entries(), "queue", most_complete,
+                          queue.empty() ? nullptr : queue.top(), expanded,
+                          start);
+      }
+      if (verbose && !(received & 0x7F)) {
+        cout << "Searched " << expanded << " boards [" << queue.size() << ":"
+             << nodes << "]; " << window << " batches in flight...\r";
+      }
+    }
+    if (stats) {
+      stats->dropped = dropped;
+      stats->expanded_early = early;
+      stats->budget_exceeded = budget_exceeded;
+    }
+    if (verbose && won) cout << endl << "Solution found." << endl << endl;
+    else if (verbose) {
+      cout << endl << (budget_exceeded ? "Search budget exceeded"
+                                       : "Search space exhausted")
+           << " after " << expanded << " boards." << endl << endl;
+    }
+    return won;
+  }
+};
+
+/// A lower bound, of sorts, on the moves left to win: every card not yet home
+/// takes one, and a card resting above a lower card of its own suit takes at
+/// least one more, to get out of the way.
+int moves_left(const Board &board) {
+  int res = TOTAL_CARDS;
+  for (card_count_t f : board.foundation) res -= f;
+  for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+    const Board::CascadeView cascade = board.cascade(i);
+    uint8_t lowest[4] = { UINT8_MAX, UINT8_MAX, UINT8_MAX, UINT8_MAX };
+    for (card_count_t k = 0; k < cascade.size; ++k) {
+      const Card c = cascade.card[k];
+      if (lowest[c.suit] < c.face) ++res;
+      else lowest[c.suit] = c.face;
+    }
+  }
+  return res;
+}
+
+/// Remembers boards seen in the current iteration of an iterative deepening
+/// search, and how few moves it took to reach them, so that a board reached
+/// again no sooner isn't searched again. Shared by every thread, without
+/// locks: each slot is one word holding part of the board's hash, the
+/// iteration, and the depth, and a thread that loses a race just loses a
+/// little pruning. A false match (the rest of the hash colliding) could prune
+/// a board that was never searched; with 40 bits of tag, that's rare enough.
+///
+/// The table is split into one partition per NUMA node, each kept in that
+/// node's memory, and a board's hash picks its partition. Probes from a
+/// thread on another node still work, just more slowly; visit() counts both.
+class TranspositionCache {
+ public:
+  /// Probes that found their partition on the prober's own node, or not.
+  struct Probes {
+    size_t local = 0, remote = 0;
+  };
+  
+  /// Makes a table spread over every node, or, given a `home` node, one
+  /// kept all in that node's memory.
+  explicit TranspositionCache(size_t bytes, int home = -1) {
+    const NumaTopology &numa = NumaTopology::get();
+    const unsigned count = home < 0 ? numa.nodes() : 1;
+    size_t slots = 1;
+    while (slots * 2 * sizeof(uint64_t) * count <= bytes) slots *= 2;
+    part_bytes = slots * sizeof(uint64_t);
+    mask = slots - 1;
+    for (unsigned i = 0; i < count; ++i) {
+      const unsigned node = home < 0 ? i : home;
+      // Fresh pages are zeroed, which is what an empty slot holds.
+      void *part = numa.map_on_node(part_bytes, node);
+      if (!part) throw std::bad_alloc();
+      parts.push_back((std::atomic<uint64_t>*) part);
+      part_nodes.push_back(node);
+    }
+  }
+  TranspositionCache(const TranspositionCache&) = delete;
+  
+  ~TranspositionCache() {
+    for (std::atomic<uint64_t> *part : parts) {
+      NumaTopology::unmap(part, part_bytes);
+    }
+  }
+  
+  /// Forgets everything, so that iteration numbers can start over.
+  void clear() {
+    for (std::atomic<uint64_t> *part : parts) {
+      for (size_t i = 0; i <= mask; ++i) {
+        part[i].store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+  
+  /// Records reaching `board` after `depth` moves in `iteration`, from a
+  /// thread on `node`. Returns false if it was already reached in as few
+  /// moves this iteration.
+  bool visit(const SearchBoard &board, unsigned depth, uint16_t iteration,
+             unsigned node, Probes *probes) {
+    return visit(hash_of(board), depth, iteration, node, probes);
+  }
+  
+  /// The same, for a board known by its hash_of().
+  bool visit(uint64_t hash, unsigned depth, uint16_t iteration,
+             unsigned node, Probes *probes) {
+    const uint64_t entry = make_entry(hash, depth, iteration);
+    std::atomic<uint64_t> &slot = find(hash, node, probes);
+    uint64_t seen = slot.load(std::memory_order_relaxed);
+    for (;;) {
+      if (covers(seen, entry)) return false;
+      if (slot.compare_exchange_weak(seen, entry, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+  
+  /// Tells whether a board was reached in as few moves this iteration,
+  /// without recording anything.
+  bool seen(uint64_t hash, unsigned depth, uint16_t iteration,
+            unsigned node, Probes *probes) {
+    const std::atomic<uint64_t> &slot = find(hash, node, probes);
+    return covers(slot.load(std::memory_order_relaxed),
+                  make_entry(hash, depth, iteration));
+  }
+  
+  /// Unlike SearchBoard::Hash, tells apart boards whose words are the same
+  /// but in a different order, since nothing here checks the board itself.
+  static uint64_t hash_of(const SearchBoard &board) {
+    uint64_t words[(sizeof(board.cards) + sizeof(board.foundation) + 7) / 8] {};
+    memcpy(words, board.cards, sizeof(board.cards));
+    memcpy((char*) words + sizeof(board.cards), board.foundation,
+           sizeof(board.foundation));
+    uint64_t res = 0;
+    for (size_t i = 0; i < std::size(words); ++i) res = mix(res ^ words[i]);
+    return res;
+  }
+  
+ private:
+  vector<std::atomic<uint64_t>*> parts;
+  vector<unsigned> part_nodes;
+  size_t part_bytes;
+  size_t mask;
+  
+  static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+  
+  std::atomic<uint64_t> &find(uint64_t hash, unsigned node, Probes *probes) {
+    const unsigned part = (hash >> 32) % parts.size();
+    ++(part_nodes[part] == node ? probes->local : probes->remote);
+    return parts[part][hash & mask];
+  }
+  
+  static uint64_t make_entry(uint64_t hash, unsigned depth,
+                             uint16_t iteration) {
+    return (hash >> 24) << 24 | (uint64_t) iteration << 8
+         | std::min(depth, 0xFFu);
+  }
+  
+  /// Whether `seen` is the same board and iteration, in no more moves.
+  static bool covers(uint64_t seen, uint64_t entry) {
+    return seen >> 8 == entry >> 8 && (seen & 0xFF) <= (entry & 0xFF);
+  }
+};
+
+/// Iterative deepening: depth-first searches from the start, each cut off
+/// where moves made plus moves_left() exceeds a bound, and each with a bound
+/// just past where the last one cut off. Memory stays proportional to the
+/// depth of the search, plus a fixed-size cache of boards seen.
+///
+/// With several threads, subtrees are tasks on per-thread deques. A thread
+/// that runs dry steals the oldest task from another, and a thread working
+/// near the root while others wait splits off its remaining siblings as
+/// tasks for them. Each thread walks its subtree on its own stack of boards,
+/// one level per move, so stepping back is just popping a level. The first
+/// thread to find a solution raises a flag that stops the rest.
+///
+/// A deterministic search instead deals each iteration out as a fixed list
+/// of tasks: the boards a few moves in, in the order a single thread would
+/// reach them. Threads take the tasks in waves of a fixed size, in step.
+/// During a wave the shared table is only read, and each task records what
+/// it reaches in a table of its own and in a log. Between waves, the logs
+/// are added to the shared table in task order. So what a task searches
+/// doesn't depend on which thread ran it, or when. The solution taken is
+/// that of the first task to find one. Threads only skip tasks after that
+/// one, so the boards counted are the same from run to run.
+class IdaSearch {
+ public:
+  /// Extra weight on moves_left(), trading optimality for speed.
+  static constexpr int kWeight = 2;
+  /// Only split off work this close to a task's root.
+  static constexpr unsigned kSplitDepth = 16;
+  /// Tasks to deal each iteration out as, in a deterministic search, and
+  /// how many of them to run at once.
+  static constexpr size_t kLayerTasks = 256;
+  static constexpr size_t kWaveTasks = 16;
+  
+  IdaSearch(const SolveOptions &options):
+      options(options), cache(kCacheBytes),
+      workers(std::max(1u, options.threads)) {}
+  
+  /// Searches from `game`. On success, fills in `path` with the index, at
+  /// each step, of the child taken among those for_each_child() makes.
+  bool run(const Board &game, vector<uint8_t> *path, SearchStats *stats) {
+    start = Clock::now();
+    const SearchBoard root { game };
+    unsigned bound = kWeight * moves_left(root);
+    WorkerTeam team(workers.size(), "ida", options.affinity,
+                    options.first_cpu);
+    for (uint16_t iteration = 1; ; ++iteration) {
+      const Clock::time_point iteration_start = Clock::now();
+      next_bound = UINT_MAX;
+      if (options.deterministic) {
+        deal_layer(root, bound);
+        first_win = SIZE_MAX;
+        for (wave_start = 0; wave_start < layer.size() && !budget_exceeded
+             && first_win == SIZE_MAX; wave_start += kWaveTasks) {
+          const Clock::time_point wave_start_time = Clock::now();
+          next_task = wave_start;
+          wave_end = std::min(layer.size(), wave_start + kWaveTasks);
+          team.run([&](unsigned t) { work_in_order(t, bound, iteration); },
+                   "wave");
+          merge_wave(iteration);
+          if (chrome_trace) {
+            chrome_trace->complete("wave " + std::to_string(
+                wave_start / kWaveTasks), "ida", wave_start_time, Clock::now(),
+                "\"tasks\": \"" + std::to_string(wave_start) + "-"
+                + std::to_string(wave_end - 1) + "\"");
+          }
+        }
+        settle();
+      } else {
+        workers[0].tasks.push_back({ root, {} });
+        outstanding = 1;
+        hungry = 0;
+        team.run([&](unsigned t) { work(t, bound, iteration); }, "search");
+        settled = expanded;
+      }
+      if (chrome_trace) {
+        chrome_trace->complete("iteration " + std::to_string(iteration),
+            "ida", iteration_start, Clock::now(), "\"bound\": "
+            + std::to_string(bound) + ", \"expanded\": "
+            + std::to_string(settled));
+      }
+      if (stats) stats->expanded = settled;
+      if (found) {
+        *path = solution;
+        break;
+      }
+      if (budget_exceeded || next_bound == UINT_MAX) break;
+      if (options.verbose) {
+        cout << "Bound " << bound << " searched; " << settled
+             << " boards so far..." << "\r" << std::flush;
+      }
+      bound = next_bound;
+    }
+    if (stats) {
+      stats->budget_exceeded = budget_exceeded;
+      for (const Worker &w : workers) {
+        stats->local_probes += w.probes.local;
+        stats->remote_probes += w.probes.remote;
+      }
+    }
+    if (options.verbose) {
+      cout << endl << (found ? "Solution found."
+                       : budget_exceeded ? "Search budget exceeded."
+                       : "Search space exhausted.") << endl << endl;
+    }
+    return found;
+  }
+  
+ private:
+  static constexpr size_t kCacheBytes = 64 << 20;
+  static constexpr size_t kOwnCacheBytes = 8 << 20;
+  static constexpr size_t kTallyEvery = 4096;
+  
+  struct Task {
+    SearchBoard board;
+    vector<uint8_t> path; ///< From the root to the board.
+  };
+  
+  /// A board reached, as a deterministic task logs it.
+  struct Visit {
+    uint64_t hash;  ///< TranspositionCache::hash_of() the board.
+    unsigned depth;
+  };
+  
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::unique_ptr<TranspositionCache> own; ///< For deterministic searches.
+    uint16_t stamp = 0;                 ///< The task number, in `own`.
+    size_t task = 0;                    ///< Its place in the layer.
+    size_t in_task = 0;                 ///< Boards it has expanded so far.
+    vector<Visit> *log = nullptr;       ///< Where the task records visits.
+    std::deque<vector<SearchBoard>> levels; ///< Children at each depth.
+    std::deque<vector<uint8_t>> orders;     ///< The order to try them in.
+    vector<uint8_t> path;
+    size_t expanded = 0;                ///< Not yet added to the total.
+    std::atomic<unsigned> node {0};     ///< The NUMA node it's running on.
+    TranspositionCache::Probes probes;
+  };
+  
+  const SolveOptions &options;
+  TranspositionCache cache;
+  vector<Worker> workers;
+  std::atomic<size_t> outstanding {0}, hungry {0}, expanded {0};
+  std::atomic<unsigned> next_bound {UINT_MAX};
+  std::atomic<bool> found {false}, budget_exceeded {false};
+  std::mutex solution_mutex;
+  vector<uint8_t> solution;
+  Clock::time_point start;
+  size_t settled = 0;             ///< Expansions the result depends on.
+  // For deterministic searches:
+  vector<Task> layer;
+  vector<size_t> task_expanded;   ///< Boards each task expanded.
+  vector<vector<Visit>> logs { kWaveTasks }; ///< The wave's, by task.
+  size_t wave_start = 0, wave_end = 0;
+  std::atomic<size_t> next_task {0}, first_win {SIZE_MAX};
+  size_t dealt = 0;               ///< Boards expanded dealing out the layer.
+  
+  /// Adds a worker's expansions to the total and checks the budget.
+  void tally(Worker &w) {
+    const size_t total = expanded += w.expanded;
+    w.expanded = 0;
+    if ((options.max_expansions && total >= options.max_expansions)
+        || (options.max_seconds
+            && std::chrono::duration<double>(Clock::now() - start).count()
+                   > options.max_seconds)) {
+      budget_exceeded = true;
+    }
+  }
+  
+  bool take_task(unsigned t, Task *task) {
+    {
+      std::lock_guard<std::mutex> lock(workers[t].mutex);
+      if (!workers[t].tasks.empty()) {
+        *task = std::move(workers[t].tasks.back());
+        workers[t].tasks.pop_back();
+        return true;
+      }
+    }
+    // Steal from threads on the same node first, since the task's board
+    // was built in their memory.
+    for (int remote = 0; remote < 2; ++remote) {
+      for (size_t i = 1; i < workers.size(); ++i) {
+        Worker &victim = workers[(t + i) % workers.size()];
+        if ((victim.node != workers[t].node) != remote) continue;
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+          *task = std::move(victim.tasks.front());
+          victim.tasks.pop_front();
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+  
+  void work(unsigned t, unsigned bound, uint16_t iteration) {
+    const NumaTopology &numa = NumaTopology::get();
+    Worker &w = workers[t];
+    Task task { SearchBoard { Board() }, {} };
+    while (outstanding.load()) {
+      w.node = options.affinity ? numa.node_of_thread(options.first_cpu + t)
+                                : numa.current_node();
+      if (!take_task(t, &task)) {
+        ++hungry;
+        while (outstanding.load() && !take_task(t, &task)) {
+          std::this_thread::yield();
+        }
+        --hungry;
+        if (!outstanding.load()) break;
+      }
+      w.path = task.path;
+      if (!found && !budget_exceeded
+          && dfs(w, task.board, task.board.depth, 0, bound, iteration)) {
+        std::lock_guard<std::mutex> lock(solution_mutex);
+        if (!found.exchange(true)) solution = w.path;
+      }
+      tally(w);
+      --outstanding;
+    }
+  }
+  
+  /// Fills `layer` with the boards a search from `root` would reach, in the
+  /// order it would reach them, going one move deeper until there are
+  /// enough, and each only the first way it's reached. Boards that are won
+  /// or past the bound are left as they are; dfs() will notice them.
+  void deal_layer(const SearchBoard &root, unsigned bound) {
+    layer.assign(1, { root, {} });
+    dealt = 0;
+    std::unordered_set<SearchBoard, SearchBoard::Hash,
+                       SearchBoard::BasicallyEqual> seen { root };
+    vector<Task> next;
+    vector<SearchBoard> children;
+    vector<uint8_t> order;
+    while (layer.size() < kLayerTasks) {
+      next.clear();
+      for (Task &task : layer) {
+        const unsigned f = task.board.depth + kWeight * moves_left(task.board);
+        if (f > bound || task.board.is_won()) {
+          next.push_back(std::move(task));
+          continue;
+        }
+        expand(task.board, children, order);
+        ++dealt;
+        for (uint8_t k : order) {
+          if (!seen.insert(children[k]).second) continue;
+          next.push_back({ children[k], task.path });
+          next.back().path.push_back(k);
+          next.back().board.previous = nullptr;
+        }
+      }
+      if (next.size() <= layer.size()) break;
+      layer.swap(next);
+    }
+    task_expanded.assign(layer.size(), 0);
+  }
+  
+  /// Searches the wave's tasks in turn with whichever threads are free.
+  void work_in_order(unsigned t, unsigned bound, uint16_t iteration) {
+    const NumaTopology &numa = NumaTopology::get();
+    Worker &w = workers[t];
+    w.node = options.affinity ? numa.node_of_thread(options.first_cpu + t)
+                              : numa.current_node();
+    if (!w.own) w.own.reset(new TranspositionCache(kOwnCacheBytes, w.node));
+    for (size_t i; (i = next_task++) < wave_end; ) {
+      if (i > first_win || budget_exceeded) break;
+      if (!++w.stamp) {
+        w.own->clear();
+        w.stamp = 1;
+      }
+      w.task = i;
+      w.in_task = 0;
+      w.log = &logs[i - wave_start];
+      w.log->clear();
+      w.path = layer[i].path;
+      const SearchBoard &board = layer[i].board;
+      if (dfs(w, board, board.depth, 0, bound, iteration)) {
+        std::lock_guard<std::mutex> lock(solution_mutex);
+        if (i < first_win) {
+          first_win = i;
+          solution = w.path;
+        }
+      }
+      task_expanded[i] = w.in_task;
+      tally(w);
+    }
+    w.task = 0;
+  }
+  
+  /// Adds what the wave's tasks reached to the shared table, in task order.
+  void merge_wave(uint16_t iteration) {
+    const unsigned node = NumaTopology::get().current_node();
+    if (first_win != SIZE_MAX) return;
+    for (size_t i = wave_start; i < wave_end; ++i) {
+      for (const Visit &v : logs[i - wave_start]) {
+        cache.visit(v.hash, v.depth, iteration, node, &workers[0].probes);
+      }
+    }
+  }
+  
+  /// Totals up the expansions of a deterministic iteration that mattered.
+  void settle() {
+    found = first_win != SIZE_MAX;
+    const size_t last = found ? first_win + 1 : task_expanded.size();
+    settled += dealt;
+    for (size_t i = 0; i < last; ++i) settled += task_expanded[i];
+  }
+  
+  /// Describes the search on stderr, as seen from worker `w`, which is about
+  /// to search below `board`, `level` moves into its task. Its frontier is
+  /// the children it has yet to try at each level above, and its tasks.
+  void dump_state(Worker &w, const SearchBoard &board, unsigned level,
+                  unsigned bound, uint16_t iteration) {
+    const double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    const size_t total = expanded + w.expanded;
+    std::ostringstream res;
+    res << "\n=== Search state after " << elapsed << " s ===\n"
+        << "Iteration " << iteration << ", bound " << bound
+        << "; expanded about " << total << " boards ("
+        << (elapsed ? total / elapsed : 0) << " per second).\n";
+    if (options.deterministic) {
+      res << "Tasks " << wave_start << " - " << wave_end - 1 << " of "
+          << layer.size() << " running; this thread is on " << w.task
+          << ".\n";
+    } else {
+      res << outstanding << " tasks outstanding, " << hungry
+          << " threads waiting for work.\n";
+    }
+    res.setf(std::ios::fixed);
+    res.precision(1);
+    res << "Memory: RSS " << proc_status_kb("VmRSS") / 1024.0
+        << " MiB (peak " << proc_status_kb("VmHWM") / 1024.0 << " MiB)\n"
+        << "\nBoard this thread is expanding (" << board.depth
+        << " moves deep, " << level << " into its task, heuristic="
+        << board.calc_heuristic() << ", moves left >= " << moves_left(board)
+        << "):\n" << board.inflate().str();
+    
+    // The children still to try, at each level of this thread's path; the
+    // last one is still whole, since it was only just expanded.
+    res << "\nChildren left to try, by level:\n";
+    for (unsigned i = 0; i <= level; ++i) {
+      const vector<uint8_t> &order = w.orders[i];
+      size_t left = order.size();
+      if (i < level) {
+        left -= std::find(order.begin(), order.end(), w.path[
+                    w.path.size() - level + i]) - order.begin() + 1;
+      }
+      char label[48];
+      snprintf(label, sizeof(label), "  %4u %3zu ", board.depth - level + i,
+               left);
+      res << label << string(left, '#') << "\n";
+    }
+    std::lock_guard<std::mutex> lock(w.mutex);
+    res << w.tasks.size() << " tasks queued on this thread.\n";
+    cerr << res.str() << endl;
+  }
+  
+  /// Makes the children of `board`, and lists them in the order to try them.
+  static void expand(const SearchBoard &board, vector<SearchBoard> &children,
+                     vector<uint8_t> &order) {
+    children.clear();
+    order.clear();
+    for_each_child(board, [&](SearchBoard &&child) {
+      child.heuristic = child.calc_heuristic();
+      order.push_back(children.size());
+      children.push_back(std::move(child));
+    });
+    std::stable_sort(order.begin(), order.end(), [&](uint8_t a, uint8_t b) {
+      return children[a].heuristic > children[b].heuristic;
+    });
+  }
+  
+  /// Searches below `board`, reached in `g` moves, `level` moves into the
+  /// current task. Leaves the path to a win in w.path on success.
+  bool dfs(Worker &w, const SearchBoard &board, unsigned g,
+           unsigned level, unsigned bound, uint16_t iteration) {
+    const unsigned f = g + kWeight * moves_left(board);
+    if (f > bound) {
+      for (unsigned b = next_bound; f < b
+           && !next_bound.compare_exchange_weak(b, f); ) {}
+      return false;
+    }
+    if (board.is_won()) return true;
+    if (found.load(std::memory_order_relaxed)
+        || budget_exceeded.load(std::memory_order_relaxed)
+        || w.task > first_win.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    if (w.own) {
+      const uint64_t hash = TranspositionCache::hash_of(board);
+      if (cache.seen(hash, g, iteration, w.node, &w.probes)
+          || !w.own->visit(hash, g, w.stamp, w.node, &w.probes)) {
+        return false;
+      }
+      w.log->push_back({ hash, g });
+    } else if (!cache.visit(board, g, iteration, w.node, &w.probes)) {
+      return false;
+    }
+    
+    if (w.levels.size() <= level) {
+      w.levels.resize(level + 1);
+      w.orders.resize(level + 1);
+    }
+    vector<SearchBoard> &children = w.levels[level];
+    vector<uint8_t> &order = w.orders[level];
+    expand(board, children, order);
+    ++w.in_task;
+    if (++w.expanded == kTallyEvery) tally(w);
+    if (search_dump_requested.load(std::memory_order_relaxed)
+        && search_dump_requested.exchange(false)) {
+      dump_state(w, board, level, bound, iteration);
+    }
+    
+    for (size_t k = 0; k < order.size(); ++k) {
+      // Hand the rest of this level to whoever is waiting for work.
+      if (level < kSplitDepth && k + 1 < order.size() && !w.own
+          && hungry.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        for (size_t rest = k + 1; rest < order.size(); ++rest) {
+          Task split { children[order[rest]], w.path };
+          split.path.push_back(order[rest]);
+          split.board.previous = nullptr;
+          w.tasks.push_back(std::move(split));
+          ++outstanding;
+        }
+        order.resize(k + 1);
+      }
+      w.path.push_back(order[k]);
+      if (dfs(w, children[order[k]], g + 1, level + 1, bound, iteration)) {
+        return true;
+      }
+      w.path.pop_back();
+    }
+    return false;
+  }
+};
+
+/// Runs an iterative deepening search, and lays the solution it finds, if
+/// any, into the move graph, returning the winning board like search().
+const SearchBoard *ida_search(const Board &game, MoveGraph &move_graph,
+                              const SolveOptions &options,
+                              SearchStats *stats = nullptr) {
+  vector<uint8_t> path;
+  if (!IdaSearch(options).run(game, &path, stats)) return nullptr;
+  const SearchBoard *board = &*move_graph.insert(SearchBoard { game }).first;
+  for (uint8_t pick : path) {
+    const SearchBoard *next = nullptr;
+    size_t k = 0;
+    for_each_child(*board, [&](SearchBoard &&child) {
+      if (k++ == pick) next = &*move_graph.insert(std::move(child)).first;
+    });
+    board = next;
+  }
+  if (stats) stats->graph_size = stats->peak_graph = move_graph.size();
+  return board;
+}
+
+MoveList solve(Board game, const SolveOptions &options,
+               PhaseTimings *timings = nullptr, SearchStats *stats = nullptr) {
+  MoveList res;
+  std::unique_ptr<MoveGraph> move_graph(new MoveGraph);
+  const SearchBoard *winning_board;
+  {
+    PhaseTimer timer(timings, PhaseTimings::SEARCH);
+    if (options.beam_width) {
+      winning_board = beam_search(game, *move_graph, options, stats);
+    } else if (options.pipeline) {
+      winning_board = PipelineSearch(*move_graph, options)
+                          .run(game, options, stats);
+    } else if (options.ida) {
+      winning_board = ida_search(game, *move_graph, options, stats);
+    } else {
+      winning_board = search(game, *move_graph, options, stats);
+    }
+  }
+  if (winning_board) {
+    PhaseTimer timer(timings, PhaseTimings::RECONSTRUCT);
+    res = describeMoves(*winning_board);
+  }
+  {
+    PhaseTimer timer(timings, PhaseTimings::TEARDOWN);
+    move_graph.reset();
+  }
+  return res;
+}
+
+/// A search that can be run again and again without going back to the heap
+/// once it's warm: the move graph's nodes and buckets, the queue, and the
+/// expansion buffer all carry over from one search to the next.
+class Solver {
+ public:
+  Solver(): graph(0, SearchBoard::Hash(), SearchBoard::BasicallyEqual(),
+                  PoolAllocator<SearchBoard>(&pool)) {}
+  
+  /// Searches from `game`. Returns the winning board, which lives until the
+  /// next search, or null, setting `exceeded` if the budget ran out first.
+  const SearchBoard *solve(const Board &game, const SolveOptions &options,
+                           bool *exceeded) {
+    graph.clear();
+    SearchStats stats;
+    const SearchBoard *won = search(game, graph, options, &stats, &scratch);
+    *exceeded = stats.budget_exceeded;
+    return won;
+  }
+  
+  /// Bytes kept from one search to the next.
+  size_t bytes_held() const {
+    return pool.bytes_held()
+         + (graph.bucket_count() + scratch.queue.capacity()
+            + scratch.expansion.children.capacity()) * sizeof(void*);
+  }
+  
+ private:
+  NodePool pool;  // Declared first, to outlive the graph.
+  MoveGraph graph;
+  SearchScratch scratch;
+};
+
+/// Answers "what should I play next?" for a game in progress, keeping the move
+/// graph and plan from one position to the next. A position on the current
+/// plan is answered by lookup. Anywhere else, the search restarts from that
+/// position over the graph already built, and stops as soon as it reaches a
+/// board on the old plan, whose remaining moves it then reuses.
+class HintSession {
+ public:
+  size_t lookups = 0;  ///< Hints answered from the current plan.
+  size_t searches = 0; ///< Hints that needed a search.
+  
+  explicit HintSession(const SolveOptions &options): options(options) {
+    this->options.verbose = false;
+  }
+  
+  /// Finds the next move to play from `position`, and if asked, the board it
+  /// leads to. Returns false if the position is won, or if the search ran out
+  /// of budget or moves.
+  bool hint(const Board &position, Move *move, Board *next = nullptr) {
+    size_t step = 0;
+    auto it = graph->find(SearchBoard { position });
+    auto on_plan = it == graph->end() ? plan_index.end() : plan_index.find(&*it);
+    if (on_plan != plan_index.end() && on_plan->second < plan_moves.size()) {
+      ++lookups;
+      step = on_plan->second;
+    } else {
+      if (position.is_won()) return false;
+      ++searches;
+      if (graph->size() > kMaxGraph) reset();
+      if (!replan(position)) return false;
+    }
+    *move = plan_moves[step];
+    if (next) *next = *plan_nodes[step + 1];
+    return true;
+  }
+  
+  /// Moves in the current plan, from where it was last searched.
+  size_t plan_length() const { return plan_moves.size(); }
+  size_t graph_size() const { return graph->size(); }
+  
+ private:
+  /// Past this many boards, start over rather than keep the graph growing.
+  static constexpr size_t kMaxGraph = 4 * GC_UPPER_BOUND;
+  
+  SolveOptions options;
+  std::unique_ptr<MoveGraph> graph { new MoveGraph };
+  vector<const SearchBoard*> plan_nodes; ///< Boards on the plan, in order.
+  vector<Move> plan_moves;               ///< The move played from each but
+                                         ///< the last, which is won.
+  std::unordered_map<const SearchBoard*, size_t> plan_index;
+  
+  void reset() {
+    graph.reset(new MoveGraph);
+    plan_nodes.clear();
+    plan_moves.clear();
+    plan_index.clear();
+  }
+  
+  bool replan(const Board &position) {
+    // Forget every path to the old root, so the search can lay new ones
+    // through boards it has seen before.
+    for (const SearchBoard &b : *graph) {
+      b.previous = nullptr;
+      b.depth = UINT_MAX;
+    }
+    auto root = graph->insert(SearchBoard { position }).first;
+    root->depth = 0;
+    root->action_taken = Move::kGameStartMove;
+    root->heuristic = root->calc_heuristic();
+    
+    // A board reached again by a shorter path is scored anew and queued
+    // again, so each entry keeps the score it was queued with, and one that
+    // no longer matches its board is stale and skipped.
+    typedef std::pair<int, const SearchBoard*> Entry;
+    const auto less = [](const Entry &a, const Entry &b) {
+      return a.first < b.first;
+    };
+    vector<Entry> queue { { root->heuristic, &*root } };
+    const Clock::time_point start = Clock::now();
+    const SearchBoard *goal = nullptr;
+    for (size_t expanded = 0; !queue.empty(); ++expanded) {
+      const SearchBoard *board = queue.front().second;
+      if (queue.front().first != board->heuristic) {
+        std::pop_heap(queue.begin(), queue.end(), less);
+        queue.pop_back();
+        continue;
+      }
+      if (board->is_won() || plan_index.count(board)) { goal = board; break; }
+      if ((options.max_expansions && expanded >= options.max_expansions)
+          || (options.max_seconds && !(expanded & 0x3FF)
+              && std::chrono::duration<double>(Clock::now() - start).count()
+                     > options.max_seconds)) {
+        break;
+      }
+      std::pop_heap(queue.begin(), queue.end(), less);
+      queue.pop_back();
+      for (const SearchBoard *child : possible_moves(*board, *graph, true).children) {
+        queue.push_back({ child->heuristic, child });
+        std::push_heap(queue.begin(), queue.end(), less);
+      }
+      while (queue.size() > GC_UPPER_BOUND) queue.pop_back();
+    }
+    if (!goal) return false;
+    
+    // The new plan runs from the position to the goal, then on as before.
+    vector<const SearchBoard*> nodes { goal };
+    vector<Move> moves;
+    for (const SearchBoard *b = goal; b->previous; b = b->previous) {
+      nodes.push_back(b->previous);
+      moves.push_back(b->action_taken);
+    }
+    std::reverse(nodes.begin(), nodes.end());
+    std::reverse(moves.begin(), moves.end());
+    auto rest = plan_index.find(goal);
+    if (rest != plan_index.end()) {
+      nodes.pop_back();
+      nodes.insert(nodes.end(), plan_nodes.begin() + rest->second,
+                   plan_nodes.end());
+      moves.insert(moves.end(), plan_moves.begin() + rest->second,
+                   plan_moves.end());
+    }
+    plan_nodes.swap(nodes);
+    plan_moves.swap(moves);
+    plan_index.clear();
+    for (size_t i = 0; i < plan_nodes.size(); ++i) plan_index[plan_nodes[i]] = i;
+    return !plan_moves.empty();
+  }
+};
+
+// =============================================================================
+// === C Interface =============================================================
+// =============================================================================
+
+struct fc_solver {
+  Solver solver;
+};
+
+fc_solver *fc_solver_new() {
+  return new (std::nothrow) fc_solver;
+}
+
+int fc_solve(fc_solver *solver, const uint8_t *board_bytes,
+             const fc_options *options, fc_move *out_moves, size_t out_cap) {
+  Board game;
+  if (!game.unpack(board_bytes)) return FC_INVALID_BOARD;
+  SolveOptions solve_options;
+  solve_options.verbose = false;
+  if (options) {
+    solve_options.max_expansions = options->max_expansions;
+    solve_options.max_seconds = options->max_seconds;
+    solve_options.max_bytes = options->max_bytes;
+    if (options->cells > RESERVE_SIZE) return FC_INVALID_BOARD;
+    if (options->cells) game.cells = options->cells;
+  }
+  for (card_count_t i = game.cells; i < RESERVE_SIZE; ++i) {
+    if (game.reserve[i]) return FC_INVALID_BOARD;
+  }
+  bool exceeded;
+  const SearchBoard *won = solver->solver.solve(game, solve_options, &exceeded);
+  if (!won) return exceeded ? FC_BUDGET_EXCEEDED : FC_UNSOLVABLE;
+  
+  // The path runs backwards from the win; lay the moves out from the end.
+  size_t length = 0;
+  for (const SearchBoard *b = won; b->previous; b = b->previous) ++length;
+  size_t i = length;
+  for (const SearchBoard *b = won; b->previous; b = b->previous) {
+    if (--i >= out_cap) continue;
+    const Move &m = b->action_taken;
+    out_moves[i] = { m.source, m.dest, (uint8_t) m.count };
+  }
+  return std::min<size_t>(length, INT_MAX);
+}
+
+size_t fc_solver_memory(const fc_solver *solver) {
+  return solver->solver.bytes_held();
+}
+
+void fc_solver_free(fc_solver *solver) {
+  delete solver;
+}
+
+// =============================================================================
+// === Verification ============================================================
+// =============================================================================
+
+static_assert(NUM_DECKS == 1, "The verifier locates cards by value.");
+
+/// A deliberately separate, minimal implementation of the rules, for checking
+/// solutions without trusting the search's own move generation or the Board
+/// copy primitives. It keeps each cascade in its own fixed array and indexes
+/// every card's location, so each move costs a handful of loads and stores.
+class RulesBoard {
+  enum Where: uint8_t { NOWHERE, CASCADE, RESERVE, FOUNDATION };
+  struct Location {
+    Where where;
+    uint8_t index;
+  };
+  
+  Card cascade[CASCADE_COUNT][TOTAL_CARDS];
+  card_count_t height[CASCADE_COUNT] {};
+  Card reserve[RESERVE_SIZE];
+  card_count_t cells;
+  card_count_t foundation[4] {};
+  Location location[64] {};
+  
+  static bool red(Card c) {
+    return c.suit == Card::HEART || c.suit == Card::DIAMOND;
+  }
+  static bool stacks_onto(Card top, Card bottom) {
+    return top.face + 1 == bottom.face && red(top) != red(bottom);
+  }
+  
+  int free_reserves() const {
+    int res = 0;
+    for (card_count_t i = 0; i < cells; ++i) if (!reserve[i]) ++res;
+    return res;
+  }
+  int empty_cascades() const {
+    int res = 0;
+    for (card_count_t h : height) if (!h) ++res;
+    return res;
+  }
+  
+  /// Lifts `count` cards off the location of `src`, returning the lead card.
+  const char *lift(Card src, int count, Location &from, Card *lead) {
+    from = location[src.value & 63];
+    switch (from.where) {
+      case NOWHERE:
+        return "source card is not on the board";
+      case CASCADE: {
+        const card_count_t h = height[from.index];
+        if (cascade[from.index][h - 1].value != src.value) {
+          return "source card is not at the end of its cascade";
+        }
+        if (count < 1 || count > h) return "cascade is too short";
+        for (int i = h - count; i < h - 1; ++i) {
+          if (!stacks_onto(cascade[from.index][i + 1],
+                           cascade[from.index][i])) {
+            return "cards moved together are not in sequence";
+          }
+        }
+        *lead = cascade[from.index][h - count];
+        height[from.index] -= count;
+        return nullptr;
+      }
+      case RESERVE:
+        if (count != 1) return "only one card can move from a reserve";
+        *lead = src;
+        reserve[from.index].clear();
+        return nullptr;
+      case FOUNDATION:
+        if (count != 1) return "only one card can move from the foundation";
+        if (foundation[src.suit] != src.face) {
+          return "source card is not on top of its foundation";
+        }
+        *lead = src;
+        --foundation[src.suit];
+        return nullptr;
+    }
+    return "corrupt card location";
+  }
+  
+  /// Puts back cards taken by lift() after finding the move is illegal.
+  void unlift(Card src, int count, Location from) {
+    switch (from.where) {
+      case CASCADE: height[from.index] += count; break;
+      case RESERVE: reserve[from.index] = src; break;
+      case FOUNDATION: ++foundation[src.suit]; break;
+      case NOWHERE: break;
+    }
+  }
+  
+  void drop_onto_cascade(card_count_t dest, Location from, int count) {
+    const card_count_t base = height[from.index];
+    for (int i = 0; i < count; ++i) place(dest, cascade[from.index][base + i]);
+  }
+  
+  void place(card_count_t dest, Card c) {
+    cascade[dest][height[dest]++] = c;
+    location[c.value & 63] = { CASCADE, dest };
+  }
+  
+ public:
+  /// Applies a move. Returns null on success, or the reason the move is
+  /// illegal (in which case the board is left as it was).
+  const char *apply(const Move &move) {
+    const Card src(move.source);
+    if (move.source <= 0 || src.face < Card::A || src.face > Card::K) {
+      return "source is not a card";
+    }
+    const int count = move.count;
+    const int free = free_reserves(), empty = empty_cascades();
+    Location from;
+    Card lead;
+    if (const char *err = lift(src, count, from, &lead)) return err;
+    
+    const char *err = nullptr;
+    switch (move.dest) {
+      case Move::FOUNDATION:
+        if (count != 1) { err = "only one card can move to the foundation"; break; }
+        if (foundation[src.suit] + 1 != src.face) {
+          err = "card does not follow the top of its foundation";
+          break;
+        }
+        ++foundation[src.suit];
+        location[src.value & 63] = { FOUNDATION, (uint8_t) src.suit };
+        return nullptr;
+      
+      case Move::RESERVE:
+        if (count != 1) { err = "only one card can move to a reserve"; break; }
+        if (from.where == FOUNDATION) {
+          err = "cards cannot leave the foundation for a reserve";
+          break;
+        }
+        for (card_count_t i = 0; i < cells; ++i) if (!reserve[i]) {
+          reserve[i] = src;
+          location[src.value & 63] = { RESERVE, i };
+          return nullptr;
+        }
+        err = "no reserve is empty";
+        break;
+      
+      case Move::CASCADE: {
+        int dest = -1;
+        for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
+          if (!height[i] && !(from.where == CASCADE && from.index == i)) {
+            dest = i;
+            break;
+          }
+        }
+        if (dest < 0) { err = "no cascade is empty"; break; }
+        if (count > (free + 1) << (empty - 1)) {
+          err = "too many cards to move with the free cells available";
+          break;
+        }
+        if (from.where == CASCADE) drop_onto_cascade(dest, from, count);
+        else place(dest, src);
+        return nullptr;
+      }
+      
+      default: {
+        const Card onto(move.dest);
+        const Location to = location[onto.value & 63];
+        if (move.dest <= 0 || to.where != CASCADE || !height[to.index]
+            || cascade[to.index][height[to.index] - 1].value != onto.value) {
+          err = "destination card is not at the end of a cascade";
+          break;
+        }
+        if (!stacks_onto(lead, onto)) {
+          err = "card cannot be stacked onto the destination";
+          break;
+        }
+        if (count > (free + 1) << empty) {
+          err = "too many cards to move with the free cells available";
+          break;
+        }
+        if (from.where == CASCADE) drop_onto_cascade(to.index, from, count);
+        else place(to.index, src);
+        return nullptr;
+      }
+    }
+    unlift(src, count, from);
+    return err;
+  }
+  
+  bool is_won() const {
+    for (card_count_t f : foundation) if (f != Card::K) return false;
+    return true;
+  }
+  
+  RulesBoard(const FluffyBoard &deal): cells(deal.cells) {
+    for (card_count_t i = 0; i < CASCADE_COUNT && i < deal.cascades.size(); ++i) {
+      for (Card c : deal.cascades[i]) place(i, c);
+    }
+    for (card_count_t i = 0; i < RESERVE_SIZE; ++i) {
+      reserve[i] = deal.reserve[i];
+      if (reserve[i]) location[reserve[i].value & 63] = { RESERVE, i };
+    }
+    for (card_count_t s = 0; s < 4; ++s) {
+      foundation[s] = deal.foundation[s].face;
+      for (int f = Card::A; f <= foundation[s]; ++f) {
+        location[Card((Card::Face) f, (Card::Suit) s).value & 63] =
+            { FOUNDATION, s };
+      }
+    }
+  }
+};
+
+struct VerifyResult {
+  bool valid = false;
+  size_t moves_applied = 0; ///< Number of legal moves before any failure.
+  string error;             ///< Why the solution is invalid, if it is.
+};
+
+/// Replays a move list from the given deal, checking that every move is legal
+/// and that the game is won at the end.
+VerifyResult verify_solution(const FluffyBoard &deal, const vector<Move> &moves) {
+  VerifyResult res;
+  RulesBoard board(deal);
+  for (const Move &move : moves) {
+    if (const char *err = board.apply(move)) {
+      res.error = "Move " + std::to_string(res.moves_applied + 1) + " ("
+                + move.str() + ") is illegal: " + err;
+      return res;
+    }
+    ++res.moves_applied;
+  }
+  if (!board.is_won()) {
+    res.error = "All " + std::to_string(res.moves_applied)
+              + " moves are legal, but the game is not won";
+    return res;
+  }
+  res.valid = true;
+  return res;
+}
+
+// =============================================================================
+// === Benchmarking ============================================================
+// =============================================================================
+
+/// Deals game number `deal` of the original Microsoft FreeCell (1 to 32000,
+/// though any 31-bit number works), using its C runtime's rand().
+FluffyBoard microsoft_deal(uint32_t deal) {
+  static const Card::Suit kSuits[4] = {
+    Card::CLUB, Card::DIAMOND, Card::HEART, Card::SPADE
+  };
+  int deck[52];
+  for (int i = 0; i < 52; ++i) deck[i] = 51 - i;
+  uint32_t seed = deal;
+  for (int i = 0; i < 51; ++i) {
+    seed = (seed * 214013 + 2531011) & 0x7FFFFFFF;
+    const int j = 51 - (seed >> 16) % (52 - i);
+    std::swap(deck[i], deck[j]);
+  }
+  FluffyBoard res;
+  res.cascades.resize(CASCADE_COUNT);
+  for (int i = 0; i < 52; ++i) {
+    res.cascades[i % CASCADE_COUNT].push_back(
+        Card((Card::Face) (deck[i] / 4 + 1), kSuits[deck[i] % 4]));
+  }
+  return res;
+}
+
+/// A small, fast generator whose output is the same on every platform, which
+/// the standard distributions don't promise. From Vigna's SplitMix64.
+struct SplitMix64 {
+  uint64_t state;
+  explicit SplitMix64(uint64_t seed): state(seed) {}
+  uint64_t operator()() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  /// Returns a number in [0, n), with negligible bias for small n.
+  uint32_t below(uint32_t n) { return (uint32_t) ((*this)() % n); }
+};
+
+/// Deals a uniformly shuffled deck in the usual eight-cascade layout.
+FluffyBoard random_deal(SplitMix64 &rng) {
+  Card deck[52];
+  for (int i = 0; i < 52; ++i) {
+    deck[i] = Card((Card::Face) (i / 4 + 1), (Card::Suit) (i % 4));
+  }
+  for (int i = 51; i > 0; --i) std::swap(deck[i], deck[rng.below(i + 1)]);
+  FluffyBoard res;
+  res.cascades.resize(CASCADE_COUNT);
+  for (int i = 0; i < 52; ++i) res.cascades[i % CASCADE_COUNT].push_back(deck[i]);
+  return res;
+}
+
+/// Plays up to `moves` random legal moves from `board`, never revisiting the
+/// position it just left. Stops early if it runs out of moves.
+Board random_playout(const Board &board, unsigned moves, SplitMix64 &rng) {
+  Board res = board, prev = board;
+  MoveGraph scratch;
+  for (unsigned m = 0; m < moves; ++m) {
+    scratch.clear();
+    if (m) scratch.insert(SearchBoard { prev });
+    Expansion next = possible_moves(SearchBoard { res }, scratch);
+    if (next.children.empty()) break;
+    prev = res;
+    res = *next.children[rng.below(next.children.size())];
+  }
+  return res;
+}
+
+double thread_cpu_seconds() {
+# ifdef CLOCK_THREAD_CPUTIME_ID
+    timespec ts;
+    if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+      return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+# endif
+  return std::chrono::duration<double>(
+      Clock::now().time_since_epoch()).count();
+}
+
+/// Nearest-rank percentile of an already-sorted sample.
+double percentile(const vector<double> &sorted, double pct) {
+  if (sorted.empty()) return 0;
+  size_t rank = (size_t) std::ceil(pct / 100 * sorted.size());
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+struct DealResult {
+  enum Outcome { SOLVED, UNSOLVED, TIMEOUT, INVALID, OUTCOME_COUNT };
+  uint32_t deal = 0;
+  Outcome outcome = UNSOLVED;
+  size_t moves = 0, expanded = 0, bytes = 0;
+  double cpu_seconds = 0;
+  vector<double> seconds; ///< Wall time of each repetition.
+  
+  static const char *name(Outcome o) {
+    static const char *const names[OUTCOME_COUNT] = {
+      "solved", "unsolved", "timeout", "invalid"
+    };
+    return names[o];
+  }
+  
+  double median_seconds() const {
+    if (seconds.empty()) return 0;
+    vector<double> s = seconds;
+    std::sort(s.begin(), s.end());
+    return s.size() % 2 ? s[s.size() / 2]
+                        : (s[s.size() / 2 - 1] + s[s.size() / 2]) / 2;
+  }
+};
+
+/// Solver metrics accumulated across many solves, in Prometheus terms.
+/// Solves on any thread may record into it; exposition may happen at any time.
+class SolverMetrics {
+  static constexpr double kLatencyBuckets[] = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30
+  };
+  static constexpr size_t kBucketCount =
+      sizeof(kLatencyBuckets) / sizeof(*kLatencyBuckets);
+  
+  struct Sample {
+    Clock::time_point when;
+    size_t solves, expanded;
+  };
+  
+  mutable std::mutex mutex;
+  size_t outcomes[DealResult::OUTCOME_COUNT] {};
+  size_t solves = 0;
+  size_t latency_buckets[kBucketCount] {}; // Not cumulative.
+  double latency_sum = 0;
+  size_t expanded = 0, generated = 0, duplicates = 0;
+  size_t graph_boards = 0, peak_graph = 0;
+  mutable std::deque<Sample> samples; ///< Recent totals, for rates.
+  
+ public:
+  void record(DealResult::Outcome outcome, double seconds,
+              const SearchStats &stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++outcomes[outcome];
+    ++solves;
+    for (size_t b = 0; b < kBucketCount; ++b) {
+      if (seconds <= kLatencyBuckets[b]) { ++latency_buckets[b]; break; }
+    }
+    latency_sum += seconds;
+    expanded += stats.expanded;
+    generated += stats.generated;
+    duplicates += stats.duplicates;
+    graph_boards += stats.peak_graph;
+    peak_graph = std::max(peak_graph, stats.peak_graph);
+  }
+  
+  /// Renders the metrics in the Prometheus text exposition format. Rates are
+  /// averaged over the last minute or so of calls to this function.
+  string exposition() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Clock::time_point now = Clock::now();
+    samples.push_back({ now, solves, expanded });
+    while (samples.size() > 2
+           && now - samples[1].when > std::chrono::seconds(60)) {
+      samples.pop_front();
+    }
+    const Sample &old = samples.front();
+    const double window =
+        std::chrono::duration<double>(now - old.when).count();
+    
+    std::ostringstream res;
+    res.precision(9);
+    res << "# HELP freecell_solves_total Solves finished, by outcome.\n"
+           "# TYPE freecell_solves_total counter\n";
+    for (int o = 0; o < DealResult::OUTCOME_COUNT; ++o) {
+      res << "freecell_solves_total{outcome=\""
+          << DealResult::name((DealResult::Outcome) o) << "\"} "
+          << outcomes[o] << "\n";
+    }
+    res << "# HELP freecell_solves_per_second Recent rate of finished solves.\n"
+           "# TYPE freecell_solves_per_second gauge\n"
+           "freecell_solves_per_second "
+        << (window > 0 ? (solves - old.solves) / window : 0) << "\n"
+        << "# HELP freecell_solve_duration_seconds Wall time of each solve.\n"
+           "# TYPE freecell_solve_duration_seconds histogram\n";
+    size_t cumulative = 0;
+    for (size_t b = 0; b < kBucketCount; ++b) {
+      cumulative += latency_buckets[b];
+      res << "freecell_solve_duration_seconds_bucket{le=\""
+          << kLatencyBuckets[b] << "\"} " << cumulative << "\n";
+    }
+    res << "freecell_solve_duration_seconds_bucket{le=\"+Inf\"} " << solves
+        << "\n"
+        << "freecell_solve_duration_seconds_sum " << latency_sum << "\n"
+        << "freecell_solve_duration_seconds_count " << solves << "\n"
+        << "# HELP freecell_boards_expanded_total Boards expanded by all solves.\n"
+           "# TYPE freecell_boards_expanded_total counter\n"
+           "freecell_boards_expanded_total " << expanded << "\n"
+        << "# HELP freecell_boards_expanded_per_second Recent expansion rate.\n"
+           "# TYPE freecell_boards_expanded_per_second gauge\n"
+           "freecell_boards_expanded_per_second "
+        << (window > 0 ? (expanded - old.expanded) / window : 0) << "\n"
+        << "# HELP freecell_closed_set_boards_total Sum of the final move graph"
+           " sizes of all solves.\n"
+           "# TYPE freecell_closed_set_boards_total counter\n"
+           "freecell_closed_set_boards_total " << graph_boards << "\n"
+        << "# HELP freecell_closed_set_boards_max Largest move graph of any"
+           " solve.\n"
+           "# TYPE freecell_closed_set_boards_max gauge\n"
+           "freecell_closed_set_boards_max " << peak_graph << "\n"
+        << "# HELP freecell_budget_exceeded_total Solves that gave up over"
+           " budget.\n"
+           "# TYPE freecell_budget_exceeded_total counter\n"
+           "freecell_budget_exceeded_total "
+        << outcomes[DealResult::TIMEOUT] << "\n"
+        << "# HELP freecell_closed_set_hit_ratio Fraction of generated boards"
+           " already in the move graph.\n"
+           "# TYPE freecell_closed_set_hit_ratio gauge\n"
+           "freecell_closed_set_hit_ratio "
+        << (generated ? (double) duplicates / generated : 0) << "\n";
+    return res.str();
+  }
+};
+
+/// Publishes a SolverMetrics while a batch runs: rewritten periodically into
+/// a file (atomically, by renaming over it), and/or served over HTTP on a
+/// localhost-only port. Each runs on its own background thread.
+class MetricsExporter {
+  const SolverMetrics &metrics;
+  std::atomic<bool> done {false};
+  vector<std::thread> threads;
+  int listener = -1;
+  
+  void write_file(const string &fname) const {
+    const string tmp = fname + ".tmp";
+    {
+      std::ofstream out(tmp);
+      out << metrics.exposition();
+      if (!out) return;
+    }
+    std::rename(tmp.c_str(), fname.c_str());
+  }
+  
+  void file_loop(string fname, double interval) const {
+    while (!done) {
+      write_file(fname);
+      for (double waited = 0; waited < interval && !done; waited += 0.1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+    }
+    write_file(fname);
+  }
+  
+#ifdef __linux__
+  void serve_loop() const {
+    while (!done) {
+      pollfd pfd { listener, POLLIN, 0 };
+      if (poll(&pfd, 1, 100) <= 0) continue;
+      const int client = accept(listener, nullptr, nullptr);
+      if (client < 0) continue;
+      // A client that connects and says nothing, or stops reading, must not
+      // hold up the sweep's exit; give it a second either way.
+      const timeval timeout { 1, 0 };
+      setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      pollfd cfd { client, POLLIN, 0 };
+      int ready = 0;
+      for (int waited = 0; waited < 10 && !done && !ready; ++waited) {
+        ready = poll(&cfd, 1, 100);
+      }
+      char request[4096];
+      if (ready > 0 && recv(client, request, sizeof(request), 0) > 0) {
+        const string body = metrics.exposition();
+        const string response =
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.length()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+        for (size_t sent = 0; sent < response.length(); ) {
+          ssize_t n = send(client, response.data() + sent,
+                           response.length() - sent, MSG_NOSIGNAL);
+          if (n <= 0) break;
+          sent += n;
+        }
+      }
+      close(client);
+    }
+  }
+#endif
+  
+ public:
+  string error; ///< Why the HTTP endpoint couldn't be opened, if it couldn't.
+  
+  MetricsExporter(const SolverMetrics &m, const string &fname, double interval,
+                  int port): metrics(m) {
+    if (!fname.empty()) {
+      threads.emplace_back(&MetricsExporter::file_loop, this, fname, interval);
+    }
+    if (!port) return;
+#   ifdef __linux__
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    const int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 || bind(listener, (sockaddr*) &addr, sizeof(addr))
+        || listen(listener, 8)) {
+      error = string("cannot listen on 127.0.0.1:") + std::to_string(port)
+            + ": " + strerror(errno);
+      if (listener >= 0) close(listener);
+      listener = -1;
+      return;
+    }
+    threads.emplace_back(&MetricsExporter::serve_loop, this);
+#   else
+    error = "serving metrics over HTTP is not supported on this platform";
+#   endif
+  }
+  
+  ~MetricsExporter() {
+    done = true;
+    for (std::thread &t : threads) t.join();
+#   ifdef __linux__
+    if (listener >= 0) close(listener);
+#   endif
+  }
+};
+
+struct SweepOptions {
+  uint32_t first = 1, last = 32000;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  unsigned repeat = 1;
+  card_count_t cells = RESERVE_SIZE; ///< Free cells to deal each game with.
+  SolveOptions solve;
+  SolverMetrics *metrics = nullptr; ///< Where to record each solve, if anywhere.
+  
+  SweepOptions() {
+    solve.verbose = false;
+    solve.max_expansions = 100000;
+  }
+};
+
+/// Solves (and verifies) one deal as many times as the sweep asks.
+DealResult solve_deal(uint32_t deal, const SweepOptions &options) {
+  DealResult res;
+  res.deal = deal;
+  FluffyBoard game = microsoft_deal(deal);
+  game.cells = options.cells;
+  for (unsigned rep = 0; rep < options.repeat; ++rep) {
+    SearchStats stats;
+    const double cpu_start = thread_cpu_seconds();
+    const Clock::time_point start = Clock::now();
+    MoveList solution = solve(Board { game }, options.solve, nullptr, &stats);
+    res.seconds.push_back(
+        std::chrono::duration<double>(Clock::now() - start).count());
+    res.cpu_seconds += thread_cpu_seconds() - cpu_start;
+    res.expanded = stats.expanded;
+    res.bytes = stats.total_bytes();
+    res.moves = solution.size();
+    if (!solution.empty()) {
+      const Clock::time_point verify_start = Clock::now();
+      res.outcome = verify_solution(game, solution.moves).valid
+          ? DealResult::SOLVED : DealResult::INVALID;
+      if (chrome_trace) {
+        chrome_trace->complete("verify", "phase", verify_start, Clock::now());
+      }
+    } else {
+      res.outcome = stats.budget_exceeded
+          ? DealResult::TIMEOUT : DealResult::UNSOLVED;
+    }
+    if (options.metrics) {
+      options.metrics->record(res.outcome, res.seconds.back(), stats);
+    }
+    if (chrome_trace) {
+      chrome_trace->complete("deal " + std::to_string(deal), "solve", start,
+          Clock::now(), "\"outcome\": \"" + string(DealResult::name(res.outcome))
+          + "\", \"expanded\": " + std::to_string(stats.expanded)
+          + ", \"moves\": " + std::to_string(res.moves));
+    }
+  }
+  return res;
+}
+
+/// Solves every deal in the range on a pool of threads.
+vector<DealResult> run_sweep(const SweepOptions &options, bool progress) {
+  const size_t count = options.last - options.first + 1;
+  vector<DealResult> results(count);
+  std::atomic<size_t> next {0}, done {0};
+  vector<std::thread> workers;
+  for (unsigned t = 0; t < options.threads; ++t) {
+    workers.emplace_back([&, t] {
+      if (chrome_trace) chrome_trace->name_thread("worker " + std::to_string(t));
+      // Deals solved at once pin their search threads to CPUs of their own.
+      SweepOptions mine = options;
+      mine.solve.first_cpu = t * std::max(1u, options.solve.threads);
+      for (size_t i; (i = next++) < count; ++done) {
+        results[i] = solve_deal(options.first + i, mine);
+      }
+    });
+  }
+  while (progress && done < count) {
+    cerr << "Swept " << done << " / " << count << " deals...\r" << std::flush;
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+  for (std::thread &w : workers) w.join();
+  if (progress) cerr << "Swept " << count << " / " << count << " deals." << endl;
+  return results;
+}
+
+struct SweepSummary {
+  size_t outcomes[DealResult::OUTCOME_COUNT] {};
+  size_t expanded = 0, max_expanded = 0;
+  double cpu_seconds = 0, wall_seconds = 0;
+  double p50 = 0, p90 = 0, p99 = 0, max = 0;
+  vector<double> times; ///< Sorted median solve time of each deal.
+  
+  SweepSummary(const vector<DealResult> &results, double wall):
+      wall_seconds(wall) {
+    for (const DealResult &r : results) {
+      ++outcomes[r.outcome];
+      expanded += r.expanded;
+      max_expanded = std::max(max_expanded, r.expanded);
+      cpu_seconds += r.cpu_seconds;
+      times.push_back(r.median_seconds());
+    }
+    std::sort(times.begin(), times.end());
+    p50 = percentile(times, 50);
+    p90 = percentile(times, 90);
+    p99 = percentile(times, 99);
+    max = times.empty() ? 0 : times.back();
+  }
+  
+  /// Solve times bucketed on a 1-2-5 log scale, drawn as a bar chart.
+  string histogram() const {
+    std::ostringstream res;
+    double lo = 0, hi = 1e-3;
+    size_t widest = 0;
+    vector<std::pair<double, size_t>> buckets;
+    for (size_t i = 0, step = 0; i < times.size(); ++step) {
+      size_t n = 0;
+      while (i < times.size() && times[i] < hi) { ++n; ++i; }
+      buckets.push_back({hi, n});
+      widest = std::max(widest, n);
+      hi *= step % 3 == 1 ? 2.5 : 2;
+    }
+    res.setf(std::ios::fixed);
+    for (auto &b : buckets) {
+      char label[48];
+      snprintf(label, sizeof(label), "  %8.3f - %8.3f s %7zu ", lo, b.first,
+               b.second);
+      res << label << string(widest ? b.second * 50 / widest : 0, '#') << "\n";
+      lo = b.first;
+    }
+    return res.str();
+  }
+  
+  string str() const {
+    std::ostringstream res;
+    res.setf(std::ios::fixed);
+    res.precision(4);
+    const size_t deals = times.size();
+    res << "Solve time histogram (median of repetitions):\n" << histogram()
+        << "Deals:     " << deals << " (" << outcomes[DealResult::SOLVED]
+        << " solved, " << outcomes[DealResult::UNSOLVED] << " unsolved, "
+        << outcomes[DealResult::TIMEOUT] << " over budget, "
+        << outcomes[DealResult::INVALID] << " failed verification)\n"
+        << "Latency:   p50 " << p50 << " s, p90 " << p90 << " s, p99 " << p99
+        << " s, max " << max << " s\n"
+        << "Expanded:  " << expanded << " boards (mean "
+        << (deals ? expanded / deals : 0) << ", max " << max_expanded << ")\n";
+    res.precision(2);
+    res << "CPU time:  " << cpu_seconds << " s over " << wall_seconds
+        << " s wall (" << (wall_seconds ? deals / wall_seconds : 0)
+        << " deals/s)\n";
+    return res.str();
+  }
+};
+
+/// Just enough of a JSON reader to load the files this program writes.
+struct JsonValue {
+  enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+  double number = 0;
+  string str;
+  vector<JsonValue> items;
+  std::map<string, JsonValue> members;
+  
+  const JsonValue &operator[](const string &key) const {
+    static const JsonValue null;
+    auto it = members.find(key);
+    return it == members.end() ? null : it->second;
+  }
+  
+  /// Parses a complete document. Returns false on malformed input.
+  static bool parse(const string &text, JsonValue *out) {
+    size_t i = 0;
+    if (!out->parse_value(text, i)) return false;
+    skip_space(text, i);
+    return i == text.length();
+  }
+  
+ private:
+  static void skip_space(const string &text, size_t &i) {
+    while (i < text.length() && std::isspace(text[i])) ++i;
+  }
+  
+  static bool parse_string(const string &text, size_t &i, string *out) {
+    if (text[i++] != '"') return false;
+    for (; i < text.length() && text[i] != '"'; ++i) {
+      if (text[i] != '\\') { *out += text[i]; continue; }
+      if (++i >= text.length()) return false;
+      switch (text[i]) {
+        case 'n': *out += '\n'; break;
+        case 'r': *out += '\r'; break;
+        case 't': *out += '\t'; break;
+        case 'u':
+          if (i + 4 >= text.length()) return false;
+          *out += (char) strtol(text.substr(i + 1, 4).c_str(), nullptr, 16);
+          i += 4;
+          break;
+        default: *out += text[i];
+      }
+    }
+    return i++ < text.length();
+  }
+  
+  bool parse_value(const string &text, size_t &i) {
+    skip_space(text, i);
+    if (i >= text.length()) return false;
+    switch (text[i]) {
+      case '{':
+        type = OBJECT;
+        for (++i;;) {
+          skip_space(text, i);
+          if (i < text.length() && text[i] == '}' && members.empty()) break;
+          string key;
+          if (i >= text.length() || !parse_string(text, i, &key)) return false;
+          skip_space(text, i);
+          if (i >= text.length() || text[i++] != ':') return false;
+          if (!members[key].parse_value(text, i)) return false;
+          skip_space(text, i);
+          if (i < text.length() && text[i] == ',') { ++i; continue; }
+          break;
+        }
+        return i < text.length() && text[i++] == '}';
+      case '[':
+        type = ARRAY;
+        for (++i;;) {
+          skip_space(text, i);
+          if (i < text.length() && text[i] == ']' && items.empty()) break;
+          items.emplace_back();
+          if (!items.back().parse_value(text, i)) return false;
+          skip_space(text, i);
+          if (i < text.length() && text[i] == ',') { ++i; continue; }
+          break;
+        }
+        return i < text.length() && text[i++] == ']';
+      case '"':
+        type = STRING;
+        return parse_string(text, i, &str);
+      case 't': case 'f': case 'n': {
+        for (const char *word : { "true", "false", "null" }) {
+          if (!text.compare(i, strlen(word), word)) {
+            type = *word == 'n' ? NUL : BOOL;
+            number = *word == 't';
+            i += strlen(word);
+            return true;
+          }
+        }
+        return false;
+      }
+      default: {
+        const char *start = text.c_str() + i;
+        char *end;
+        number = strtod(start, &end);
+        if (end == start) return false;
+        type = NUMBER;
+        i += end - start;
+        return true;
+      }
+    }
+  }
+};
+
+/// Regularized incomplete beta function I_x(a, b), by continued fraction.
+double incomplete_beta(double a, double b, double x) {
+  if (x <= 0) return 0;
+  if (x >= 1) return 1;
+  if (x > (a + 1) / (a + b + 2)) return 1 - incomplete_beta(b, a, 1 - x);
+  const double front = std::exp(std::lgamma(a + b) - std::lgamma(a)
+      - std::lgamma(b) + a * std::log(x) + b * std::log(1 - x)) / a;
+  constexpr double kTiny = 1e-30;
+  double f = 1, c = 1, d = 0;
+  for (int i = 0; i <= 200; ++i) {
+    const int m = i / 2;
+    double num;
+    if (!i) num = 1;
+    else if (i % 2) num = -((a + m) * (a + b + m) * x) / ((a + 2*m) * (a + 2*m + 1));
+    else num = (m * (b - m) * x) / ((a + 2*m - 1) * (a + 2*m));
+    d = 1 + num * d;
+    d = 1 / (std::fabs(d) < kTiny ? kTiny : d);
+    c = 1 + num / c;
+    if (std::fabs(c) < kTiny) c = kTiny;
+    f *= c * d;
+    if (std::fabs(1 - c * d) < 1e-10) break;
+  }
+  return front * (f - 1);
+}
+
+/// Two-sided p-value of Student's t statistic with the given degrees of freedom.
+double t_test_p(double t, double df) {
+  if (!(df > 0) || std::isnan(t)) return 1;
+  return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+/// Welch's t-test of whether two samples share a mean. Returns the p-value,
+/// or 1 when either sample is too small to tell.
+double welch_p(const vector<double> &a, const vector<double> &b) {
+  if (a.size() < 2 || b.size() < 2) return 1;
+  auto moments = [](const vector<double> &v, double *mean, double *var) {
+    *mean = 0;
+    for (double x : v) *mean += x;
+    *mean /= v.size();
+    *var = 0;
+    for (double x : v) *var += (x - *mean) * (x - *mean);
+    *var /= v.size() - 1;
+  };
+  double ma, va, mb, vb;
+  moments(a, &ma, &va);
+  moments(b, &mb, &vb);
+  const double sa = va / a.size(), sb = vb / b.size();
+  if (sa + sb <= 0) return ma == mb ? 1 : 0;
+  const double t = (ma - mb) / std::sqrt(sa + sb);
+  const double df = (sa + sb) * (sa + sb)
+      / (sa * sa / (a.size() - 1) + sb * sb / (b.size() - 1));
+  return t_test_p(t, df);
+}
+
+void write_sweep_json(std::ostream &out, const SweepOptions &options,
+                      const vector<DealResult> &results,
+                      const SweepSummary &summary) {
+  out.precision(9);
+  out << "{\n"
+      << "  \"benchmark\": \"microsoft\",\n"
+      << "  \"first\": " << options.first << ",\n"
+      << "  \"last\": " << options.last << ",\n"
+      << "  \"threads\": " << options.threads << ",\n"
+      << "  \"repeat\": " << options.repeat << ",\n"
+      << "  \"max_expansions\": " << options.solve.max_expansions << ",\n"
+      << "  \"max_seconds\": " << options.solve.max_seconds << ",\n"
+      << "  \"summary\": {";
+  for (int o = 0; o < DealResult::OUTCOME_COUNT; ++o) {
+    out << '"' << DealResult::name((DealResult::Outcome) o) << "\": "
+        << summary.outcomes[o] << ", ";
+  }
+  out << "\"expanded\": " << summary.expanded
+      << ", \"cpu_seconds\": " << summary.cpu_seconds
+      << ", \"wall_seconds\": " << summary.wall_seconds
+      << ", \"p50\": " << summary.p50 << ", \"p90\": " << summary.p90
+      << ", \"p99\": " << summary.p99 << ", \"max\": " << summary.max << "},\n"
+      << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const DealResult &r = results[i];
+    out << "    {\"deal\": " << r.deal
+        << ", \"outcome\": \"" << DealResult::name(r.outcome) << '"'
+        << ", \"moves\": " << r.moves << ", \"expanded\": " << r.expanded
+        << ", \"bytes\": " << r.bytes << ", \"cpu_seconds\": " << r.cpu_seconds
+        << ", \"seconds\": [";
+    for (size_t j = 0; j < r.seconds.size(); ++j) {
+      out << (j ? ", " : "") << r.seconds[j];
+    }
+    out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+
+// =============================================================================
+// === Presentation Logic ======================================================
+// =============================================================================
+
+/// The number of cards a move from one cascade to another means when
+/// standard notation doesn't say: onto a card, the one run that fits it; onto
+/// an empty cascade, as many as can go.
+card_count_t implied_count(const Board &board, card_count_t from,
+                           card_count_t to) {
+  const Board::CascadeView run = board.cascade(from);
+  const Card onto = board.cascade_back(to);
+  const card_count_t empty = board.count_empty_cascades();
+  const size_t most = onto ? run.size
+      : (size_t) (board.count_free_reserves() + 1) << (empty - 1);
+  card_count_t count = 1;
+  for (card_count_t n = 1; n <= run.size && n <= most; ++n) {
+    const Card lead = run.card[run.size - n];
+    if (!onto) {
+      count = n;
+    } else if (tableau_stackable(onto, lead)) {
+      count = n;
+      break;
+    }
+    if (n == run.size || !tableau_stackable(run.card[run.size - n - 1], lead)) {
+      break;
+    }
+  }
+  return count;
+}
+
+// This game was such a turd, I wrote this program.
+const string kSampleGame =
+    ": 6C 9S 2H AC JD AS 9C 7H\n"
+    ": 2D AD QC KD JC JS 3D 2C\n"
+    ": KC TD 7D 9D QD TS 6D 6H\n"
+    ": 8S TH 3H KS 2S QS 8C KH\n"
+    ": AH JH 7C 8H 5H 8D 5D 3S\n"
+    ": 4S TC 4D QH 4C 3C 5C 6S\n"
+    ": 9H 4H 5S 7S";
+
+/// Renders whole solutions into one reusable buffer, so that printing a
+/// solution costs one write and, once the buffer has grown to fit, no
+/// allocations. Three styles:
+///  - HUMAN: "Move the Four of Hearts onto the foundation", as Move::str().
+///  - COMPACT: standard notation, e.g. "4h 3a a5 36 17x2": cascades are 1-8,
+///    reserves a-d, and the foundation h. "xN" marks a move of N cards only
+///    where the notation alone would mean some other number, as can happen
+///    moving onto an empty cascade.
+///  - BINARY: a little-endian 16-bit move count, then each Move's three bytes.
+class SolutionFormatter {
+ public:
+  enum Style { HUMAN, COMPACT, BINARY };
+  
+  static bool parse_style(const string &desc, Style *style) {
+    if (desc == "human") *style = HUMAN;
+    else if (desc == "compact") *style = COMPACT;
+    else if (desc == "binary") *style = BINARY;
+    else return false;
+    return true;
+  }
+  
+  /// Formats a solution. Returns false if a move doesn't replay (compact
+  /// style only), leaving the buffer holding those before it.
+  bool format(const MoveList &solution, Style style) {
+    const vector<Move> &moves = solution.moves;
+    used = 0;
+    switch (style) {
+      case HUMAN:
+        for (const Move &m : moves) human(m);
+        return true;
+      case COMPACT: {
+        MoveList::Replay replay(solution);
+        MoveSpots spots;
+        for (size_t i = 0; i < moves.size(); ++i) {
+          const Board before = replay.current();
+          if (!replay.next(&spots)) return false;
+          if (i) put(' ');
+          put(spot(spots.from, spots.from_index));
+          if (spots.from == Move::FOUNDATION) {
+            put(Card::kSuitChars[Card(moves[i].source).suit]);
+          }
+          put(spot(spots.to, spots.to_index));
+          const card_count_t implied =
+              spots.from == Move::CASCADE && spots.to == Move::CASCADE
+              ? implied_count(before, spots.from_index, spots.to_index) : 1;
+          if (moves[i].count != implied) put('x'), number(moves[i].count);
+        }
+        if (!moves.empty()) put('\n');
+        return true;
+      }
+      case BINARY:
+        put(moves.size() & 0xFF);
+        put(moves.size() >> 8 & 0xFF);
+        for (const Move &m : moves) put(m.source), put(m.dest), put(m.count);
+        return true;
+    }
+    return false;
+  }
+  
+  const char *data() const { return buffer.data(); }
+  size_t size() const { return used; }
+  
+  void write(std::ostream &out) const {
+    out.write(buffer.data(), used);
+    out.flush();
+  }
+  
+ private:
+  vector<char> buffer;
+  size_t used = 0;
+  
+  void put(char c) {
+    if (used == buffer.size()) buffer.resize(std::max<size_t>(256, 2 * used));
+    buffer[used++] = c;
+  }
+  void put(const char *str) { while (*str) put(*str++); }
+  void number(unsigned n) {
+    if (n >= 10) number(n / 10);
+    put('0' + n % 10);
+  }
+  
+  void name(int8_t place) {
+    switch (place) {
+      case Move::CASCADE: put("an empty cascade"); return;
+      case Move::RESERVE: put("an empty reserve"); return;
+      case Move::FOUNDATION: put("the foundation"); return;
+    }
+    const Card card(place);
+    put("the ");
+    put(Card::kFaceNames[card.face]);
+    put(" of ");
+    put(Card::kSuitNames[card.suit]);
+  }
+  
+  void human(const Move &m) {
+    put("Move ");
+    name(m.source);
+    if (m.count > 1) put(" (and "), number(m.count - 1), put(" more)");
+    put(" onto ");
+    name(m.dest);
+    put('\n');
+  }
+  
+  static char spot(Move::Place where, card_count_t index) {
+    switch (where) {
+      case Move::CASCADE: return '1' + index;
+      case Move::RESERVE: return 'a' + index;
+      default: return 'h';
+    }
+  }
+};
+
+/// Reads one move in the standard notation the compact style writes (and most
+/// other solvers share): the source and destination spots, "1"-"8" for the
+/// cascades, "a"-"d" for the free cells and "h" for the foundations, with an
+/// optional "xN" for a run of N cards. Without a count, a move between
+/// cascades carries as many cards as it takes to land, or onto an empty
+/// cascade, as many as may move. A card taken back off the foundations names
+/// its suit if it could be either ("hH4"). Fills in the move as played on
+/// `board`, and the free cell or empty cascade it lands in as `slot` for
+/// replay_move().
+bool read_standard_move(const Board &board, const string &token, Move *move,
+                        int *slot) {
+  struct Spot { Move::Place where; card_count_t index; };
+  auto read_spot = [&board](char c, Spot *spot) {
+    if (c >= '1' && c < '1' + CASCADE_COUNT) {
+      *spot = { Move::CASCADE, (card_count_t) (c - '1') };
+    } else if (c >= 'a' && c < 'a' + board.cells) {
+      *spot = { Move::RESERVE, (card_count_t) (c - 'a') };
+    } else if (c == 'h') {
+      *spot = { Move::FOUNDATION, 0 };
+    } else {
+      return false;
+    }
+    return true;
+  };
+  Spot from, to;
+  size_t pos = 0;
+  if (token.empty() || !read_spot(token[pos++], &from)) return false;
+  Card::Suit suit = Card::SPADE;
+  const bool named_suit = from.where == Move::FOUNDATION && pos < token.size()
+      && isupper(token[pos]) && Card::read_suit(token[pos], &suit);
+  if (named_suit) ++pos;
+  if (pos >= token.size() || !read_spot(token[pos++], &to)) return false;
+  unsigned long count = 0;
+  if (pos < token.size()) {
+    char *end;
+    count = strtoul(token.c_str() + pos + 1, &end, 10);
+    if (token[pos] != 'x' || *end || !count || count > TOTAL_CARDS) {
+      return false;
+    }
+  }
+  
+  Card src;
+  switch (from.where) {
+    case Move::RESERVE:
+      src = board.reserve[from.index];
+      break;
+    case Move::CASCADE:
+      src = board.cascade_back(from.index);
+      break;
+    default: {
+      // Only a card that would stack where it's going can come back down.
+      const Card onto = to.where == Move::CASCADE ? board.cascade_back(to.index)
+                                                  : Card();
+      for (int s = 0; s < 4; ++s) {
+        if (named_suit ? s != suit : !board.foundation[s]) continue;
+        const Card top((Card::Face) board.foundation[s], (Card::Suit) s);
+        if (named_suit || !onto || tableau_stackable(onto, top)) {
+          if (src) return false;  // Ambiguous; the suit must be named.
+          src = top;
+        }
+      }
+      if (to.where != Move::CASCADE || count > 1) return false;
+    }
+  }
+  if (!src) return false;
+  move->source = src.value;
+  *slot = -1;
+  switch (to.where) {
+    case Move::FOUNDATION:
+      move->dest = Move::FOUNDATION;
+      break;
+    case Move::RESERVE:
+      move->dest = Move::RESERVE;
+      *slot = to.index;
+      break;
+    default: {
+      const Card back = board.cascade_back(to.index);
+      if (back) {
+        move->dest = back.value;
+      } else {
+        move->dest = Move::CASCADE;
+        *slot = to.index;
+      }
+    }
+  }
+  
+  if (!count) {
+    count = from.where == Move::CASCADE && to.where == Move::CASCADE
+          ? implied_count(board, from.index, to.index) : 1;
+  }
+  move->count = count;
+  return true;
+}
+
+double pearson(const vector<double> &x, const vector<double> &y) {
+  const size_t n = x.size();
+  if (n < 2) return 0;
+  double mx = 0, my = 0;
+  for (size_t i = 0; i < n; ++i) { mx += x[i]; my += y[i]; }
+  mx /= n; my /= n;
+  double sxy = 0, sxx = 0, syy = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sxy += (x[i] - mx) * (y[i] - my);
+    sxx += (x[i] - mx) * (x[i] - mx);
+    syy += (y[i] - my) * (y[i] - my);
+  }
+  return sxx && syy ? sxy / std::sqrt(sxx * syy) : 0;
+}
+
+/// Reads a trace written by --trace and summarizes where the search spent its
+/// effort: how the frontier evolved, how well the heuristic tracked the path
+/// that was eventually found, and which abandoned subtrees cost the most.
+int trace_report(const string &fname) {
+  std::ifstream in(fname, std::ios::binary);
+  char magic[sizeof(kTraceMagic)];
+  if (!in.read(magic, sizeof(magic))
+      || !std::equal(magic, magic + sizeof(magic), kTraceMagic)) {
+    cerr << "\"" << fname << "\" is not a search trace." << endl;
+    return 2;
+  }
+  vector<TraceRecord> recs;
+  for (TraceRecord rec; in.read((char*) &rec, sizeof(rec)); ) {
+    recs.push_back(rec);
+  }
+  
+  size_t node_count = 0, expansions = 0;
+  for (const TraceRecord &rec : recs) {
+    if (rec.kind == TraceRecord::NEW) {
+      node_count = std::max<size_t>(node_count, rec.node + 1);
+    }
+    if (rec.kind == TraceRecord::EXPAND) ++expansions;
+  }
+  constexpr size_t kNever = ~(size_t) 0;
+  vector<uint32_t> parent(node_count, TraceRecord::kNoParent);
+  vector<const TraceRecord*> created(node_count);
+  vector<size_t> expanded_at(node_count, kNever);
+  vector<const TraceRecord*> path;
+  
+  cout << "Frontier evolution (" << recs.size() << " records):" << endl;
+  cout << "  expanded    time_ms       open      graph   dup%   mean_h  "
+          "max_depth" << endl;
+  const size_t interval = std::max<size_t>(1, expansions / 20);
+  size_t expanded = 0, open = 0, graph = 0, drops = 0;
+  size_t iv_children = 0, iv_dups = 0, iv_depth = 0;
+  double iv_heur = 0;
+  size_t iv_expanded = 0;
+  auto print_row = [&](uint32_t micros) {
+    char line[128];
+    snprintf(line, sizeof(line),
+             "  %8zu %10.1f %10zu %10zu %6.1f %8.0f %10zu",
+             expanded, micros / 1000.0, open, graph,
+             iv_children ? 100.0 * iv_dups / iv_children : 0.0,
+             iv_expanded ? iv_heur / iv_expanded : 0.0, iv_depth);
+    cout << line << endl;
+    iv_children = iv_dups = iv_depth = iv_expanded = 0;
+    iv_heur = 0;
+  };
+  for (const TraceRecord &rec : recs) {
+    switch (rec.kind) {
+      case TraceRecord::NEW:
+        parent[rec.node] = rec.parent;
+        created[rec.node] = &rec;
+        ++open; ++graph; ++iv_children;
+        break;
+      case TraceRecord::DUPLICATE:
+        ++iv_dups; ++iv_children;
+        break;
+      case TraceRecord::EXPAND:
+        if (rec.node < node_count) expanded_at[rec.node] = expanded;
+        --open; ++expanded; ++iv_expanded;
+        iv_heur += rec.heuristic;
+        iv_depth = std::max<size_t>(iv_depth, rec.depth);
+        if (!(expanded % interval)) print_row(rec.micros);
+        break;
+      case TraceRecord::DROP:
+        --open; ++drops;
+        break;
+      case TraceRecord::SOLUTION:
+        path.push_back(&rec);
+        break;
+    }
+  }
+  if (iv_expanded && !recs.empty()) print_row(recs.back().micros);
+  if (drops) cout << "  (" << drops << " boards dropped from the queue)" << endl;
+  
+  if (path.empty()) {
+    cout << endl << "No solution recorded; nothing to compare against." << endl;
+    return 0;
+  }
+  
+  const size_t length = path.size() - 1;
+  vector<bool> on_path(node_count);
+  vector<double> heur, togo;
+  for (size_t k = 0; k < path.size(); ++k) {
+    if (path[k]->node < node_count) on_path[path[k]->node] = true;
+    heur.push_back(path[k]->heuristic);
+    togo.push_back(length - k);
+  }
+  cout << endl << "Heuristic accuracy against the final path ("
+       << length << " moves):" << endl;
+  cout << "  Expansions on the path: " << length << " of " << expansions
+       << " (" << (expansions ? 100.0 * length / expansions : 0)
+       << "% efficiency)" << endl;
+  cout << "  Correlation of heuristic with moves remaining: "
+       << pearson(heur, togo) << " (-1 is ideal)" << endl;
+  size_t inversions = 0;
+  for (size_t k = 1; k < path.size(); ++k) {
+    if (path[k]->heuristic < path[k - 1]->heuristic) ++inversions;
+  }
+  cout << "  Steps along the path where the heuristic got worse: "
+       << inversions << endl;
+  
+  struct Stall { size_t step, cost; };
+  vector<Stall> stalls;
+  for (size_t k = 1; k + 1 < path.size(); ++k) {
+    size_t a = expanded_at[path[k - 1]->node], b = expanded_at[path[k]->node];
+    if (a != kNever && b != kNever && b > a) stalls.push_back({k, b - a - 1});
+  }
+  std::sort(stalls.begin(), stalls.end(),
+            [](const Stall &a, const Stall &b) { return a.cost > b.cost; });
+  if (stalls.size() > 5) stalls.resize(5);
+  cout << "  Steps the search took longest to commit to:" << endl;
+  for (const Stall &st : stalls) {
+    const TraceRecord &r = *path[st.step];
+    cout << "    #" << st.step << " (" << st.cost << " expansions in between): "
+         << Move(Card(r.source), Card(r.dest), r.count).str() << endl;
+  }
+  
+  // Attribute every off-path board to the child of a path board from which
+  // its branch diverged. Parents are always created before their children.
+  vector<uint32_t> subtree(node_count);
+  struct Waste { uint32_t root; size_t generated, expanded, max_depth; };
+  std::map<uint32_t, Waste> waste;
+  for (uint32_t id = 0; id < node_count; ++id) {
+    const uint32_t p = parent[id];
+    if (on_path[id] || p == TraceRecord::kNoParent || on_path[p]) {
+      subtree[id] = id;
+    } else {
+      subtree[id] = subtree[p];
+    }
+    if (on_path[id] || !created[id]) continue;
+    Waste &w = waste.emplace(subtree[id], Waste{subtree[id], 0, 0, 0})
+        .first->second;
+    ++w.generated;
+    if (expanded_at[id] != kNever) ++w.expanded;
+    w.max_depth = std::max<size_t>(w.max_depth, created[id]->depth);
+  }
+  vector<Waste> wasted;
+  size_t total_waste = 0;
+  for (auto &w : waste) {
+    wasted.push_back(w.second);
+    total_waste += w.second.expanded;
+  }
+  std::sort(wasted.begin(), wasted.end(),
+            [](const Waste &a, const Waste &b) { return a.expanded > b.expanded; });
+  if (wasted.size() > 10) wasted.resize(10);
+  cout << endl << "Wasted effort: " << total_waste << " expansions in "
+       << waste.size() << " abandoned subtrees. Largest:" << endl;
+  for (const Waste &w : wasted) {
+    const TraceRecord &r = *created[w.root];
+    cout << "  " << w.expanded << " expanded, " << w.generated
+         << " generated, to depth " << w.max_depth << ": branched at depth "
+         << r.depth - 1 << " by "
+         << Move(Card(r.source), Card(r.dest), r.count).str() << endl;
+  }
+  return 0;
+}
+
+bool read_file(const string &fname, string *contents) {
+  std::ifstream file(fname, std::ios::binary);
+  if (!file) return false;
+  contents->assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+  return true;
+}
+
+/// Whether a word has the shape of a move in standard notation ("3a", "84x3").
+bool looks_standard(const string &word) {
+  size_t pos = word[0] == 'h' && word.size() > 1 && strchr("SHDC", word[1]);
+  if (word.size() < pos + 2 || !strchr("12345678abcdh", word[0])
+      || !strchr("12345678abcdh", word[pos + 1])) {
+    return false;
+  }
+  pos += 2;
+  if (word.size() == pos) return true;
+  return word[pos] == 'x' && word.size() > pos + 1
+      && word.find_first_not_of("0123456789", pos + 1) == string::npos;
+}
+
+/// Checks a solution, as printed by this program, against the given game.
+/// Moves may be written out in prose or in standard notation; lines that
+/// aren't moves are ignored, so the solver's whole output will do. Returns 3,
+/// like `--verify`, if a move doesn't fit the board it's played on, and 1 if
+/// the moves break the rules or don't win.
+int verify_main(const string &game_fname, const string &solution_fname,
+                Board::Layout layout, card_count_t cells) {
+  string game_desc, solution_desc;
+  if (!read_file(game_fname, &game_desc)) {
+    cerr << "Failed to open input file \"" << game_fname << "\"." << endl;
+    return 2;
+  }
+  if (!read_file(solution_fname, &solution_desc)) {
+    cerr << "Failed to open solution file \"" << solution_fname << "\"." << endl;
+    return 2;
+  }
+  
+  Board board;
+  board.cells = cells;
+  string error;
+  if (!board.parse(game_desc, &error, layout)) {
+    cerr << "Invalid board: " << error << "." << endl;
+    return 2;
+  }
+  const FluffyBoard game = board.inflate();
+  
+  // Standard notation names spots rather than cards, so follow the game along
+  // to see which cards it moves.
+  vector<Move> moves;
+  std::istringstream lines(solution_desc);
+  for (string line; std::getline(lines, line); ) {
+    Move move = Move::kGameStartMove;
+    if (Move::parse(line, &move)) {
+      moves.push_back(move);
+      if (!replay_move(board, move)) {
+        cout << "Solution is INVALID. Move " << moves.size()
+             << " does not apply." << endl;
+        return 3;
+      }
+      continue;
+    }
+    std::istringstream words(line);
+    vector<string> notation { std::istream_iterator<string>(words), {} };
+    if (notation.empty()
+        || !std::all_of(notation.begin(), notation.end(), looks_standard)) {
+      continue;
+    }
+    for (const string &word : notation) {
+      int slot;
+      if (!read_standard_move(board, word, &move, &slot)
+          || !replay_move(board, move, nullptr, slot)) {
+        cout << "Solution is INVALID. Move " << moves.size() + 1 << " (\""
+             << word << "\") does not apply." << endl;
+        return 3;
+      }
+      moves.push_back(move);
+    }
+  }
+  
+  const Clock::time_point start = Clock::now();
+  VerifyResult result = verify_solution(game, moves);
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  
+  if (!result.valid) {
+    cout << "Solution is INVALID. " << result.error << "." << endl;
+    return 1;
+  }
+  cout << "Solution is valid (" << moves.size() << " moves; replayed in "
+       << elapsed.count() * 1e6 << " µs)." << endl;
+  return 0;
+}
+
+/// Splits a flag of the form "--key=value" (or "-key") into its key and value.
+/// Returns false if the argument isn't a flag at all.
+bool parse_flag(const char *arg, string *key, string *val) {
+  if (arg[0] != '-') return false;
+  *key = arg + 1 + (arg[1] == '-');
+  val->clear();
+  const size_t eq = key->find('=');
+  if (eq != string::npos) {
+    *val = key->substr(eq + 1);
+    key->erase(eq);
+  }
+  return true;
+}
+
+/// Parses "1-32000" or "617" into an inclusive range of deal numbers.
+bool parse_deal_range(const string &desc, uint32_t *first, uint32_t *last) {
+  char *end;
+  *first = *last = strtoul(desc.c_str(), &end, 10);
+  if (*end == '-') *last = strtoul(end + 1, &end, 10);
+  return !*end && *first && *first <= *last;
+}
+
+/// Parses "rows" or "columns", the layouts Board::parse() reads.
+bool parse_layout(const string &desc, Board::Layout *layout) {
+  if (desc == "rows") *layout = Board::ROWS;
+  else if (desc == "columns") *layout = Board::COLUMNS;
+  else return false;
+  return true;
+}
+
+/// Parses a number of reserve slots, from 0 to RESERVE_SIZE.
+bool parse_cells(const string &desc, card_count_t *cells) {
+  char *end;
+  const unsigned long n = strtoul(desc.c_str(), &end, 10);
+  if (desc.empty() || *end || n > RESERVE_SIZE) return false;
+  *cells = n;
+  return true;
+}
+
+/// Parses a byte count with an optional K, M, or G (binary) suffix.
+bool parse_bytes(const string &desc, size_t *bytes) {
+  char *end;
+  const double n = strtod(desc.c_str(), &end);
+  double scale = 1;
+  switch (*end) {
+    case 'K': case 'k': scale = 1 << 10; ++end; break;
+    case 'M': case 'm': scale = 1 << 20; ++end; break;
+    case 'G': case 'g': scale = 1 << 30; ++end; break;
+  }
+  if (desc.empty() || *end || n <= 0) return false;
+  *bytes = n * scale;
+  return true;
+}
+
+/// Formats a byte count as parse_bytes() would read it.
+string bytes_str(size_t bytes) {
+  static const char kUnits[] = " KMG";
+  int unit = 0;
+  while (unit < 3 && bytes >= 1024 && !(bytes % 1024)) bytes /= 1024, ++unit;
+  return std::to_string(bytes) + (unit ? string(1, kUnits[unit]) : "");
+}
+
+/// Writes out and stops collecting the current Chrome trace, saying so on
+/// `log`.
+bool write_chrome_trace(const string &fname, std::ostream &log = cout) {
+  std::unique_ptr<ChromeTrace> trace(chrome_trace);
+  chrome_trace = nullptr;
+  std::ofstream out(fname);
+  if (!out) {
+    cerr << "Failed to open \"" << fname << "\" for writing." << endl;
+    return false;
   }
+  trace->write(out);
+  log << "Trace events written to \"" << fname << "\"." << endl;
+  return true;
 }
 
-vector<const SearchBoard*>
-possible_moves(const SearchBoard &board, MoveGraph &move_graph) {
-  vector<const SearchBoard*> res;
-  card_count_t num_free_reserves = board.count_free_reserves();
-  card_count_t num_empty_cascades = board.count_empty_cascades();
-  for (card_count_t i = 0; i < CASCADE_COUNT; ++i) {
-    for (card_count_t j = 0; j < RESERVE_SIZE; ++j)  {
-      if (reserve_to_tableau_valid(board, j, i)) {
-        visit(res, reserve_to_tableau(board, j, i), move_graph);
-      }
+/// Solves a range of Microsoft deals in parallel under a fixed budget, prints
+/// the distribution of solve times, and stores the results as a baseline.
+int sweep_main(int argc, char* argv[]) {
+  SweepOptions options;
+  string json_fname = "sweep.json";
+  string metrics_fname, chrome_fname;
+  double metrics_interval = 5;
+  int metrics_port = 0;
+  for (int i = 1; i < argc; ++i) {
+    string arg, val;
+    if (!parse_flag(argv[i], &arg, &val)) {
+      cerr << "Unexpected argument `" << argv[i] << "'" << endl;
+      return 1;
     }
-    
-    if (board.cascade_empty(i)) continue;
-
-    card_count_t size = board.cascade_size(i);
-    card_count_t back = board.cascade_end(i);
-    for (card_count_t j = 0; j < CASCADE_COUNT; ++j) {
-      for (card_count_t l = 1; ; ) {
-        Card cur = board.cards[back - l];
-        if (tableau_stackable(board.cascade_back(j), cur)) {
-          visit(res, tableaux_move(board, i, j, l), move_graph);
-        }
-        if (++l > size) break;
-        if (!tableau_stackable(board.cards[back - l], cur)) break;
-        if (l > num_free_reserves + num_empty_cascades) break;
-        // XXX: It would be wise to use * above instead of +, except some
-        // freecell engines don't allow complicated automatic moves.
-      }
+    if (arg == "deals" && parse_deal_range(val, &options.first, &options.last)) continue;
+    if (arg == "threads" && atoi(val.c_str()) > 0) {
+      options.threads = atoi(val.c_str());
+      continue;
     }
-    
-    if (!board.reserve_full())  {
-      visit(res, tableau_to_reserve(board, i), move_graph);
+    if (arg == "repeat" && atoi(val.c_str()) > 0) {
+      options.repeat = atoi(val.c_str());
+      continue;
     }
-    
-    if (foundation_can_accept(board, board.cascade_back(i))) {
-      visit(res, tableau_to_foundation(board, i), move_graph);
+    if (arg == "budget" && !val.empty()) {
+      options.solve.max_expansions = strtoull(val.c_str(), nullptr, 10);
+      continue;
     }
-    
-    for (card_count_t j = 0; j < 4; ++j) {
-      if (foundation_to_tableau_valid(board, j, i)) {
-        visit(res, foundation_to_tableau(board, j, i), move_graph);
-      }
+    if (arg == "time-limit" && !val.empty()) {
+      options.solve.max_seconds = atof(val.c_str());
+      continue;
+    }
+    if (arg == "memory" && parse_bytes(val, &options.solve.max_bytes)) continue;
+    if (arg == "beam" && atoi(val.c_str()) > 0) {
+      options.solve.beam_width = atoi(val.c_str());
+      continue;
+    }
+    if (arg == "pipeline") { options.solve.pipeline = true; continue; }
+    if (arg == "pipeline-window" && atoi(val.c_str()) > 0) {
+      options.solve.pipeline_jobs = atoi(val.c_str());
+      continue;
+    }
+    if (arg == "pipeline-batch" && atoi(val.c_str()) > 0) {
+      options.solve.pipeline_boards = atoi(val.c_str());
+      continue;
+    }
+    if (arg == "ida") { options.solve.ida = true; continue; }
+    if (arg == "affinity") { options.solve.affinity = true; continue; }
+    if (arg == "deterministic") {
+      options.solve.deterministic = true;
+      continue;
+    }
+    if (arg == "search-threads" && atoi(val.c_str()) > 0) {
+      options.solve.threads = atoi(val.c_str());
+      continue;
     }
+    if (arg == "json" && !val.empty()) { json_fname = val; continue; }
+    if (arg == "chrome-trace" && !val.empty()) { chrome_fname = val; continue; }
+    if (arg == "sanity" && parse_sanity(val, &sanity_interval)) continue;
+    if (arg == "cells" && parse_cells(val, &options.cells)) continue;
+    if (arg == "metrics" && !val.empty()) { metrics_fname = val; continue; }
+    if (arg == "metrics-interval" && atof(val.c_str()) > 0) {
+      metrics_interval = atof(val.c_str());
+      continue;
+    }
+    if (arg == "metrics-port" && atoi(val.c_str()) > 0
+        && atoi(val.c_str()) <= 65535) {
+      metrics_port = atoi(val.c_str());
+      continue;
+    }
+    cerr << "Unknown or malformed flag `" << argv[i] << "'" << endl;
+    return 1;
+  }
+  if (options.solve.affinity && !options.solve.ida) {
+    cerr << "--affinity only applies to --ida." << endl;
+    return 1;
   }
   
-  for (card_count_t i = 0; i < RESERVE_SIZE; ++i)  {
-    if (foundation_can_accept(board, board.reserve[i])) {
-      visit(res, reserve_to_foundation(board, i), move_graph);
+  SolverMetrics metrics;
+  std::unique_ptr<MetricsExporter> exporter;
+  if (!metrics_fname.empty() || metrics_port) {
+    options.metrics = &metrics;
+    exporter.reset(new MetricsExporter(metrics, metrics_fname,
+                                       metrics_interval, metrics_port));
+    if (!exporter->error.empty()) {
+      cerr << "Not serving metrics: " << exporter->error << endl;
     }
   }
   
-  return res;
+  cout << "Solving Microsoft deals " << options.first << "-" << options.last
+       << " on " << options.threads << " threads (budget: ";
+  if (options.solve.max_expansions) {
+    cout << options.solve.max_expansions << " boards";
+  } else {
+    cout << "unlimited boards";
+  }
+  if (options.solve.max_seconds) cout << ", " << options.solve.max_seconds << " s";
+  if (options.solve.max_bytes) {
+    cout << ", " << bytes_str(options.solve.max_bytes) << "B";
+  }
+  cout << " per deal)..." << endl;
+  
+  if (!chrome_fname.empty()) chrome_trace = new ChromeTrace;
+  
+  const Clock::time_point start = Clock::now();
+  vector<DealResult> results = run_sweep(options, true);
+  SweepSummary summary(results,
+      std::chrono::duration<double>(Clock::now() - start).count());
+  cout << summary.str();
+  
+  std::ofstream json(json_fname);
+  if (!json) {
+    cerr << "Failed to open \"" << json_fname << "\" for writing." << endl;
+    return 2;
+  }
+  write_sweep_json(json, options, results, summary);
+  cout << "Results written to \"" << json_fname << "\"." << endl;
+  if (chrome_trace && !write_chrome_trace(chrome_fname)) return 2;
+  return summary.outcomes[DealResult::INVALID] ? 3 : 0;
 }
 
-MoveList solve(Board game) {
-  SearchQueue search;
-  MoveGraph move_graph;
+/// Compares two sweep result files, and flags regressions in the candidate.
+/// Board counts are deterministic, so any growth past the threshold counts;
+/// times are noisy, so they must also pass a significance test: Welch's t-test
+/// over repetitions for single deals, and a paired t-test of log time ratios
+/// across all deals for the aggregate.
+int bench_compare_main(int argc, char* argv[]) {
+  vector<string> files;
+  double threshold = 5, alpha = 0.05;
+  for (int i = 1; i < argc; ++i) {
+    string arg, val;
+    if (!parse_flag(argv[i], &arg, &val)) { files.push_back(argv[i]); continue; }
+    if (arg == "threshold" && !val.empty()) { threshold = atof(val.c_str()); continue; }
+    if (arg == "alpha" && !val.empty()) { alpha = atof(val.c_str()); continue; }
+    cerr << "Unknown or malformed flag `" << argv[i] << "'" << endl;
+    return 2;
+  }
+  if (files.size() != 2) {
+    cerr << "bench-compare needs a baseline file and a candidate file." << endl;
+    return 2;
+  }
   
-  auto ins = move_graph.insert(SearchBoard { game });
-  search.push(&*ins.first);
+  struct Entry {
+    string outcome;
+    double expanded = 0, bytes = 0;
+    vector<double> seconds;
+    double median() const {
+      vector<double> s = seconds;
+      std::sort(s.begin(), s.end());
+      return s.empty() ? 0 : s.size() % 2 ? s[s.size() / 2]
+          : (s[s.size() / 2 - 1] + s[s.size() / 2]) / 2;
+    }
+  };
+  std::map<uint32_t, Entry> runs[2];
+  for (int f = 0; f < 2; ++f) {
+    string text;
+    JsonValue doc;
+    if (!read_file(files[f], &text) || !JsonValue::parse(text, &doc)
+        || doc["results"].type != JsonValue::ARRAY) {
+      cerr << "\"" << files[f] << "\" is not a readable sweep result." << endl;
+      return 2;
+    }
+    for (const JsonValue &r : doc["results"].items) {
+      Entry &e = runs[f][(uint32_t) r["deal"].number];
+      e.outcome = r["outcome"].str;
+      e.expanded = r["expanded"].number;
+      e.bytes = r["bytes"].number;
+      for (const JsonValue &s : r["seconds"].items) e.seconds.push_back(s.number);
+    }
+  }
   
-  int bno = 0, ino = 0;
+  struct Delta { uint32_t deal; double base, cand, pct, p; };
+  vector<Delta> deltas;
+  // Per-deal boards expanded ([0]) and bytes ([1]). These do not vary
+  // between repeats, so a plain threshold flags them without a test.
+  struct Growth { uint32_t deal; double base[2], cand[2]; };
+  vector<Growth> growths;
+  vector<double> log_ratios;
+  double totals[2][3] {}; // [file][median seconds, expanded, bytes]
+  size_t solved[2] {}, lost = 0;
+  vector<string> regressions;
+  for (auto &b : runs[0]) {
+    auto c = runs[1].find(b.first);
+    if (c == runs[1].end()) continue;
+    const Entry *e[2] = { &b.second, &c->second };
+    for (int f = 0; f < 2; ++f) {
+      totals[f][0] += e[f]->median();
+      totals[f][1] += e[f]->expanded;
+      totals[f][2] += e[f]->bytes;
+      if (e[f]->outcome == "solved") ++solved[f];
+    }
+    if (e[0]->outcome == "solved" && e[1]->outcome != "solved") {
+      ++lost;
+      regressions.push_back("Deal " + std::to_string(b.first)
+          + " was solved, but now is " + e[1]->outcome);
+    }
+    growths.push_back({ b.first, { e[0]->expanded, e[0]->bytes },
+                        { e[1]->expanded, e[1]->bytes } });
+    const double bm = e[0]->median(), cm = e[1]->median();
+    if (bm > 0 && cm > 0) {
+      log_ratios.push_back(std::log(cm / bm));
+      deltas.push_back({ b.first, bm, cm, 100 * (cm / bm - 1),
+                         welch_p(e[0]->seconds, e[1]->seconds) });
+    }
+  }
+  if (deltas.empty()) {
+    cerr << "The two files have no deals in common." << endl;
+    return 2;
+  }
   
-  int compp = 0;
-  size_t freed_results = 0;
-  while (!search.empty()) {
-    const SearchBoard &board = *search.top();
-    const int comp = board.completion();
-    const int nmoves = board.num_moves();
-    if (board.is_won()) {
-      cout << endl << "Solution found." << endl << endl;
-      return describeMoves(board);
+  // Paired t-test across deals: is the mean log ratio nonzero?
+  double mean = 0, var = 0;
+  for (double r : log_ratios) mean += r;
+  mean /= log_ratios.size();
+  for (double r : log_ratios) var += (r - mean) * (r - mean);
+  const size_t n = log_ratios.size();
+  var = n > 1 ? var / (n - 1) : 0;
+  const double agg_p = n > 1 && var > 0
+      ? t_test_p(mean / std::sqrt(var / n), n - 1) : (mean ? 0 : 1);
+  const double agg_pct = 100 * (std::exp(mean) - 1);
+  
+  auto pct = [](double a, double b) { return a ? 100 * (b / a - 1) : 0; };
+  char line[160];
+  cout << "Comparing " << deltas.size() << " deals common to \"" << files[0]
+       << "\" and \"" << files[1] << "\":" << endl;
+  cout << "                       baseline      candidate     delta" << endl;
+  snprintf(line, sizeof(line), "  Solved             %10zu     %10zu", solved[0],
+           solved[1]);
+  cout << line << endl;
+  const char *names[3] = { "Time (s, sum)", "Boards expanded", "Memory (MiB)" };
+  const double scale[3] = { 1, 1, 1.0 / 1048576 };
+  const int precision[3] = { 3, 0, 1 };
+  for (int m = 0; m < 3; ++m) {
+    snprintf(line, sizeof(line), "  %-17s %12.*f   %12.*f   %+7.2f%%",
+             names[m], precision[m], totals[0][m] * scale[m], precision[m],
+             totals[1][m] * scale[m], pct(totals[0][m], totals[1][m]));
+    cout << line << endl;
+  }
+  snprintf(line, sizeof(line),
+           "  Per-deal time, geometric mean: %+.2f%% (paired t-test p = %.4f)",
+           agg_pct, agg_p);
+  cout << line << endl;
+  
+  std::sort(deltas.begin(), deltas.end(),
+            [](const Delta &a, const Delta &b) { return a.pct > b.pct; });
+  auto print_deltas = [&](const char *title, size_t from, size_t to, int dir) {
+    cout << title << endl;
+    for (size_t i = from; i != to; i += dir) {
+      const Delta &d = deltas[i];
+      snprintf(line, sizeof(line),
+               "  deal %6u: %9.4f s -> %9.4f s  %+8.2f%%  (p = %.4f)",
+               d.deal, d.base, d.cand, d.pct, d.p);
+      cout << line << endl;
     }
-    auto moves = possible_moves(board, move_graph);
-    search.pop();
-    for (auto &move : moves) {
-      if (!(++bno & 0xFFFF)) {
-        cout << "\nArbitrary board (heuristic=" << move->heuristic << "):\n"
-             << move->inflate().str() << endl << endl;
+  };
+  const size_t shown = std::min<size_t>(10, deltas.size());
+  print_deltas("Largest slowdowns:", 0, shown, 1);
+  print_deltas("Largest speedups:", deltas.size() - 1,
+               deltas.size() - 1 - shown, -1);
+  
+  const char *growth_titles[2] = { "Largest changes in boards expanded:",
+                                   "Largest changes in memory:" };
+  for (int m = 0; m < 2; ++m) {
+    std::stable_sort(growths.begin(), growths.end(),
+                     [&](const Growth &a, const Growth &b) {
+      return std::abs(pct(a.base[m], a.cand[m]))
+           > std::abs(pct(b.base[m], b.cand[m]));
+    });
+    cout << growth_titles[m] << endl;
+    size_t listed = 0;
+    for (const Growth &g : growths) {
+      if (listed == 10 || g.base[m] == g.cand[m]) break;
+      snprintf(line, sizeof(line), "  deal %6u: %12.*f -> %12.*f  %+8.2f%%",
+               g.deal, precision[m + 1], g.base[m] * scale[m + 1],
+               precision[m + 1], g.cand[m] * scale[m + 1],
+               pct(g.base[m], g.cand[m]));
+      cout << line << endl;
+      ++listed;
+    }
+    if (!listed) cout << "  (none)" << endl;
+  }
+  
+  for (const Delta &d : deltas) {
+    if (d.pct > threshold && d.p < alpha) {
+      snprintf(line, sizeof(line), "Deal %u is %.2f%% slower (p = %.4f)",
+               d.deal, d.pct, d.p);
+      regressions.push_back(line);
+    }
+  }
+  std::sort(growths.begin(), growths.end(),
+            [](const Growth &a, const Growth &b) { return a.deal < b.deal; });
+  for (const Growth &g : growths) {
+    for (int m = 0; m < 2; ++m) {
+      if (pct(g.base[m], g.cand[m]) <= threshold) continue;
+      snprintf(line, sizeof(line), m ? "Deal %u used %.2f%% more memory"
+               : "Deal %u expanded %.2f%% more boards", g.deal,
+               pct(g.base[m], g.cand[m]));
+      regressions.push_back(line);
+    }
+  }
+  if (agg_pct > threshold && agg_p < alpha) {
+    snprintf(line, sizeof(line), "Deals are %.2f%% slower overall (p = %.4f)",
+             agg_pct, agg_p);
+    regressions.push_back(line);
+  }
+  for (int m = 1; m < 3; ++m) {
+    if (pct(totals[0][m], totals[1][m]) > threshold) {
+      snprintf(line, sizeof(line), "%s grew by %.2f%%", names[m],
+               pct(totals[0][m], totals[1][m]));
+      regressions.push_back(line);
+    }
+  }
+  
+  if (regressions.empty()) {
+    cout << "No regressions above " << threshold << "% (alpha = " << alpha
+         << ")." << endl;
+    return 0;
+  }
+  cout << regressions.size() << " regression(s) above " << threshold
+       << "% (alpha = " << alpha << "):" << endl;
+  for (const string &r : regressions) cout << "  REGRESSION: " << r << endl;
+  return 1;
+}
+
+/// The searches the scaling harness can measure, as solve() picks them.
+const char *const kScaleModes[] = { "best-first", "beam", "pipeline", "ida" };
+
+/// One configuration measured by the scaling harness.
+struct ScalePoint {
+  const char *mode;  ///< One of kScaleModes.
+  size_t memory;     ///< Per-search memory budget in bytes, or 0 for none.
+  unsigned threads;  ///< Deals solved at once.
+  unsigned search_threads; ///< Threads each of those searches runs on.
+  double wall_seconds;
+  size_t expanded, solved, deals;
+  unsigned baseline; ///< The fewest threads measured, at the same memory.
+  double speedup, efficiency; ///< Relative to `baseline` threads.
+  
+  double nodes_per_thread_second() const {
+    return wall_seconds ? expanded / wall_seconds / threads / search_threads
+                        : 0;
+  }
+  double solve_rate() const { return deals ? (double) solved / deals : 0; }
+};
+
+/// Sweeps the same deals at a series of thread counts and memory budgets, for
+/// each search asked for, to show where throughput stops scaling with threads
+/// and where solve rates start to suffer for lack of memory.
+int scale_main(int argc, char* argv[]) {
+  SweepOptions options;
+  options.first = 1;
+  options.last = 200;
+  vector<unsigned> thread_counts;
+  vector<size_t> memories;
+  vector<const char*> modes;
+  size_t beam_width = 100;
+  string csv_fname;
+  auto add_mode = [&](const string &name) {
+    for (const char *mode : kScaleModes) {
+      if (name != mode) continue;
+      if (std::find(modes.begin(), modes.end(), mode) == modes.end()) {
+        modes.push_back(mode);
       }
-      search.push(std::move(move));
+      return true;
     }
-    if (!(ino++ & 0x1FF) || comp > compp) {
-      cout << "Searched " << ino << " boards [" << search.size()
-           << ":" << move_graph.size() << "]; " << nmoves
-           << " moves deep; maybe " << comp << "% complete...\r";
-      compp = comp;
+    return false;
+  };
+  for (int i = 1; i < argc; ++i) {
+    string arg, val;
+    if (!parse_flag(argv[i], &arg, &val)) {
+      cerr << "Unexpected argument `" << argv[i] << "'" << endl;
+      return 1;
     }
-    while (search.size() > GC_UPPER_BOUND) {
-      search.pop_back();
-      ++freed_results;
+    if (arg == "deals" && parse_deal_range(val, &options.first, &options.last)) continue;
+    if (arg == "threads" || arg == "memory") {
+      std::istringstream list(val);
+      string item;
+      bool ok = !val.empty();
+      while (ok && std::getline(list, item, ',')) {
+        size_t bytes;
+        if (arg == "memory" && item == "unlimited") memories.push_back(0);
+        else if (arg == "memory" && parse_bytes(item, &bytes)) memories.push_back(bytes);
+        else if (arg == "threads" && atoi(item.c_str()) > 0) {
+          thread_counts.push_back(atoi(item.c_str()));
+        } else {
+          ok = false;
+        }
+      }
+      if (ok) continue;
+    }
+    if (arg == "budget" && !val.empty()) {
+      options.solve.max_expansions = strtoull(val.c_str(), nullptr, 10);
+      continue;
     }
+    if (arg == "modes" && !val.empty()) {
+      std::istringstream list(val);
+      string item;
+      bool ok = true;
+      while (ok && std::getline(list, item, ',')) ok = add_mode(item);
+      if (ok) continue;
+    }
+    if (arg == "beam" && atoi(val.c_str()) > 0) {
+      beam_width = atoi(val.c_str());
+      add_mode("beam");
+      continue;
+    }
+    if (arg == "pipeline" || arg == "ida") { add_mode(arg); continue; }
+    if (arg == "search-threads" && atoi(val.c_str()) > 0) {
+      options.solve.threads = atoi(val.c_str());
+      continue;
+    }
+    if (arg == "cells" && parse_cells(val, &options.cells)) continue;
+    if (arg == "csv" && !val.empty()) { csv_fname = val; continue; }
+    cerr << "Unknown or malformed flag `" << argv[i] << "'" << endl;
+    return 1;
   }
-  if (freed_results){
-    cout << endl << "Search space exhausted (but " << freed_results
-         << " were collected due to memory limitations)." << endl << endl;
-  } else {
-    cout << endl << "Search space exhausted." << endl << endl;
+  if (modes.empty()) modes.push_back(kScaleModes[0]);
+  if (thread_counts.empty()) {
+    for (unsigned t = 1; t < options.threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(options.threads);
+  }
+  if (memories.empty()) memories.push_back(0);
+  std::sort(thread_counts.begin(), thread_counts.end());
+  
+  const size_t deals = options.last - options.first + 1;
+  cout << "Scaling over Microsoft deals " << options.first << "-"
+       << options.last << " (budget: " << options.solve.max_expansions
+       << " boards per deal)." << endl << endl;
+  vector<ScalePoint> points;
+  for (const char *mode : modes) {
+    SolveOptions &solve = options.solve;
+    solve.beam_width = mode == kScaleModes[1] ? beam_width : 0;
+    solve.pipeline = mode == kScaleModes[2];
+    solve.ida = mode == kScaleModes[3];
+    const unsigned search_threads = solve.pipeline ? PipelineSearch::kThreads
+        : solve.beam_width || solve.ida ? solve.threads : 1;
+    for (size_t memory : memories) {
+      solve.max_bytes = memory;
+      cout << "Search: " << mode;
+      if (solve.beam_width) cout << " " << solve.beam_width << " wide";
+      cout << ", on " << search_threads << " thread"
+           << (search_threads == 1 ? "" : "s") << " each; memory per search: "
+           << (memory ? bytes_str(memory) + "B" : string("unlimited")) << endl;
+      const unsigned baseline = thread_counts.front();
+      cout << "Speedup and efficiency are against " << baseline << " thread"
+           << (baseline == 1 ? "" : "s") << "." << endl;
+      cout << "  Threads   Wall (s)  Speedup  Efficiency  Boards/s/thread"
+              "  Solved" << endl;
+      double base_seconds = 0;
+      for (unsigned threads : thread_counts) {
+        options.threads = threads;
+        const Clock::time_point start = Clock::now();
+        const vector<DealResult> results = run_sweep(options, false);
+        const SweepSummary summary(results,
+            std::chrono::duration<double>(Clock::now() - start).count());
+        ScalePoint p { mode, memory, threads, search_threads,
+                       summary.wall_seconds, summary.expanded,
+                       summary.outcomes[DealResult::SOLVED], deals, baseline,
+                       1, 1 };
+        if (!base_seconds) base_seconds = p.wall_seconds;
+        p.speedup = p.wall_seconds ? base_seconds / p.wall_seconds : 0;
+        p.efficiency = p.speedup * baseline / threads;
+        char line[96];
+        snprintf(line, sizeof(line),
+                 "  %7u %10.3f %8.2f %10.1f%% %16.0f %6.1f%%", threads,
+                 p.wall_seconds, p.speedup, 100 * p.efficiency,
+                 p.nodes_per_thread_second(), 100 * p.solve_rate());
+        cout << line << endl;
+        points.push_back(p);
+      }
+      cout << endl;
+    }
+  }
+  
+  if (!csv_fname.empty()) {
+    std::ofstream csv(csv_fname);
+    csv << "mode,memory_bytes,threads,search_threads,deals,wall_seconds,"
+           "baseline_threads,speedup,efficiency,boards_per_thread_second,"
+           "solve_rate\n";
+    for (const ScalePoint &p : points) {
+      csv << p.mode << "," << p.memory << "," << p.threads << ","
+          << p.search_threads << "," << p.deals << "," << p.wall_seconds
+          << "," << p.baseline << "," << p.speedup << "," << p.efficiency
+          << "," << p.nodes_per_thread_second() << "," << p.solve_rate()
+          << "\n";
+    }
+    if (!csv.flush()) {
+      cerr << "Failed to write \"" << csv_fname << "\"." << endl;
+      return 2;
+    }
+    cout << "Results written to \"" << csv_fname << "\"." << endl;
+  }
+  return 0;
+}
+
+/// Plays a game with the user, hinting a move for every position. Press enter
+/// to play the hint, or type a move of your own in the solver's prose.
+int hint_main(int argc, char* argv[]) {
+  SolveOptions options;
+  options.max_expansions = 1000000;
+  string fname;
+  card_count_t cells = RESERVE_SIZE;
+  for (int i = 1; i < argc; ++i) {
+    string arg, val;
+    if (!parse_flag(argv[i], &arg, &val)) {
+      if (fname.empty()) { fname = argv[i]; continue; }
+      cerr << "Unexpected argument `" << argv[i] << "'" << endl;
+      return 1;
+    }
+    if (arg == "budget" && !val.empty()) {
+      options.max_expansions = strtoull(val.c_str(), nullptr, 10);
+      continue;
+    }
+    if (arg == "cells" && parse_cells(val, &cells)) continue;
+    cerr << "Unknown or malformed flag `" << argv[i] << "'" << endl;
+    return 1;
+  }
+  string game_desc;
+  if (fname.empty() || !read_file(fname, &game_desc)) {
+    cerr << "Failed to open input file \"" << fname << "\"." << endl;
+    return 2;
+  }
+  const FluffyBoard game { game_desc, cells };
+  RulesBoard rules { game };
+  Board board { game };
+  HintSession session { options };
+  
+  while (!board.is_won()) {
+    cout << endl << board.inflate().str() << endl;
+    const Clock::time_point start = Clock::now();
+    const size_t searches = session.searches;
+    Move hint = Move::kGameStartMove;
+    Board next;
+    const bool found = session.hint(board, &hint, &next);
+    const double micros =
+        std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    if (found) {
+      cout << "Hint: " << hint.str() << " ("
+           << (session.searches > searches ? "searched" : "looked up") << " in "
+           << std::fixed << std::setprecision(0) << micros << " µs; "
+           << session.plan_length() << " moves planned, "
+           << session.graph_size() << " boards known)" << endl;
+    } else {
+      cout << "No hint: couldn't find a way to win from here." << endl;
+    }
+    
+    string line;
+    if (!std::getline(std::cin, line) || line == "q") break;
+    Move move = hint;
+    if (!line.empty() && !Move::parse(line, &move)) {
+      cout << "Not a move: \"" << line << "\"." << endl;
+      continue;
+    }
+    if (line.empty() && !found) continue;
+    if (const char *err = rules.apply(move)) {
+      cout << "Illegal move: " << err << "." << endl;
+      continue;
+    }
+    if (line.empty()) board = next;
+    else replay_move(board, move);
   }
-  return {};
+  if (board.is_won()) cout << endl << "Game complete." << endl;
+  cout << session.lookups << " hints looked up, " << session.searches
+       << " searched." << endl;
+  return 0;
 }
 
+/// Writes out a position in the given layout, as Board::parse() reads it.
+string describe(const Board &position, Board::Layout layout) {
+  const FluffyBoard fluffy = position.inflate();
+  return layout == Board::COLUMNS ? fluffy.columns_desc() : fluffy.desc();
+}
 
-// =============================================================================
-// === Presentation Logic ======================================================
-// =============================================================================
+/// Whether describe()'s text for a position parses back to the same one, with
+/// every card in the cascade it was written in.
+bool reads_back(const Board &position, Board::Layout layout, string *error) {
+  const string desc = describe(position, layout);
+  Board reread;
+  reread.cells = position.cells;
+  if (!reread.parse(desc, error, layout)) return false;
+  if (describe(reread, layout) == desc) return true;
+  *error = "it reads back as a different position";
+  return false;
+}
 
-// This game was such a turd, I wrote this program.
-const string kSampleGame =
-    ": 6C 9S 2H AC JD AS 9C 7H\n"
-    ": 2D AD QC KD JC JS 3D 2C\n"
-    ": KC TD 7D 9D QD TS 6D 6H\n"
-    ": 8S TH 3H KS 2S QS 8C KH\n"
-    ": AH JH 7C 8H 5H 8D 5D 3S\n"
-    ": 4S TC 4D QH 4C 3C 5C 6S\n"
-    ": 9H 4H 5S 7S";
+constexpr char kCorpusMagic[8] = { 'F', 'C', 'D', 'E', 'A', 'L', 'S', '1' };
+
+/// Generates a reproducible corpus of random deals, or of positions reached
+/// by random play from them, optionally keeping only those the solver can
+/// finish with the given number of free cells.
+int gen_main(int argc, char* argv[]) {
+  uint64_t seed = 1;
+  size_t count = 100;
+  unsigned playout = 0;
+  bool solvable = false, binary = false;
+  card_count_t cells = RESERVE_SIZE;
+  Board::Layout layout = Board::ROWS;
+  SolveOptions solve_options;
+  solve_options.verbose = false;
+  solve_options.max_expansions = 100000;
+  string out_path;
+  for (int i = 1; i < argc; ++i) {
+    string arg, val;
+    if (!parse_flag(argv[i], &arg, &val)) {
+      cerr << "Unexpected argument `" << argv[i] << "'" << endl;
+      return 1;
+    }
+    if (arg == "seed" && !val.empty()) {
+      seed = strtoull(val.c_str(), nullptr, 10);
+      continue;
+    }
+    if (arg == "count" && atoi(val.c_str()) > 0) {
+      count = atoi(val.c_str());
+      continue;
+    }
+    if (arg == "cells" && parse_cells(val, &cells)) continue;
+    if (arg == "playout" && !val.empty()) {
+      playout = atoi(val.c_str());
+      continue;
+    }
+    if (arg == "solvable") { solvable = true; continue; }
+    if (arg == "budget" && !val.empty()) {
+      solve_options.max_expansions = strtoull(val.c_str(), nullptr, 10);
+      continue;
+    }
+    if (arg == "format" && (val == "text" || val == "binary")) {
+      binary = val == "binary";
+      continue;
+    }
+    if (arg == "layout" && parse_layout(val, &layout)) continue;
+    if (arg == "out" && !val.empty()) { out_path = val; continue; }
+    cerr << "Unknown or malformed flag `" << argv[i] << "'" << endl;
+    return 1;
+  }
+  if (binary && out_path.empty()) {
+    cerr << "Binary output needs a file: pass --out=<file>." << endl;
+    return 1;
+  }
+  
+  std::ofstream bin;
+  if (binary) {
+    bin.open(out_path, std::ios::binary);
+    if (!bin) {
+      cerr << "Failed to open \"" << out_path << "\" for writing." << endl;
+      return 2;
+    }
+    bin.write(kCorpusMagic, sizeof(kCorpusMagic));
+  }
+  
+  size_t written = 0, candidates = 0;
+  uint8_t packed[Board::PACKED_SIZE];
+  for (; written < count; ++candidates) {
+    // Every candidate has its own stream, so a corpus is a prefix of any
+    // larger one generated with the same flags.
+    SplitMix64 rng(seed ^ (candidates * 0xD1B54A32D192ED03ull));
+    Board deal { random_deal(rng) };
+    deal.cells = cells;
+    const Board position = random_playout(deal, playout, rng);
+    if (solvable && solve(position, solve_options).empty()) continue;
+    string error;
+    if (!binary && !reads_back(position, layout, &error)) {
+      cerr << "Position " << written << " was written wrongly: " << error
+           << "." << endl;
+      return 2;
+    }
+    if (binary) {
+      position.pack(packed);
+      bin.write((const char*) packed, sizeof(packed));
+    } else if (out_path.empty()) {
+      if (written) cout << endl;
+      cout << describe(position, layout);
+    } else {
+      const string fname = out_path + "/" + std::to_string(cells)
+          + "cell-" + std::to_string(written) + ".dat";
+      std::ofstream out(fname);
+      if (!(out << describe(position, layout))) {
+        cerr << "Failed to write \"" << fname << "\"." << endl;
+        return 2;
+      }
+    }
+    ++written;
+  }
+  if (binary && !bin.flush()) {
+    cerr << "Failed to write \"" << out_path << "\"." << endl;
+    return 2;
+  }
+  if (!out_path.empty()) {
+    cout << "Wrote " << written << " positions to \"" << out_path << "\"";
+    if (solvable) cout << " (" << candidates << " generated)";
+    cout << "." << endl;
+  }
+  return 0;
+}
 
 int usage(int status, const char* prg) {
   cout << "Usage: " << prg << " <game_file>"
-          " [--interactive] [--print_boards]\n" << endl;
+          " [--interactive] [--print_boards] [--timings] [--json=<file>]"
+          " [--trace=<file>] [--stats] [--perf] [--verify]"
+          " [--chrome-trace=<file>]\n"
+          "             [--sanity=off|sampled[:N]|full] [--cells=N]"
+          " [--format=human|compact|binary]\n"
+          "             [--layout=rows|columns] [--beam=<width>] [--threads=N]"
+          " [--pipeline] [--ida]\n"
+          "             [--pipeline-window=<batches>]"
+          " [--pipeline-batch=<boards>] [--affinity] [--deterministic]\n"
+       << "       " << prg << " verify <game_file> <solution_file>"
+          " [--layout=rows|columns] [--cells=N]\n"
+       << "       " << prg << " sweep [--deals=1-32000] [--threads=N]"
+          " [--budget=<boards>] [--time-limit=<seconds>] [--repeat=N]"
+          " [--json=<file>]\n"
+          "             [--memory=<bytes>] [--metrics=<file>]"
+          " [--metrics-interval=<seconds>]"
+          " [--metrics-port=<port>] [--chrome-trace=<file>]\n"
+          "             [--sanity=off|sampled[:N]|full] [--cells=N]"
+          " [--beam=<width>] [--search-threads=N]\n"
+          "             [--pipeline] [--pipeline-window=<batches>]"
+          " [--pipeline-batch=<boards>]\n"
+          "             [--ida] [--affinity] [--deterministic]\n"
+       << "       " << prg << " bench-compare <baseline.json> <candidate.json>"
+          " [--threshold=<percent>] [--alpha=<p>]\n"
+       << "       " << prg << " trace-report <trace_file>\n"
+       << "       " << prg << " hint <game_file> [--budget=<boards>]"
+          " [--cells=N]\n"
+       << "       " << prg << " scale [--deals=1-200] [--threads=1,2,4,...]"
+          " [--memory=unlimited,256M,...] [--budget=<boards>]\n"
+          "             [--modes=best-first,beam,pipeline,ida]"
+          " [--beam=<width>] [--pipeline] [--ida]\n"
+          "             [--search-threads=N] [--cells=N] [--csv=<file>]\n"
+       << "       " << prg << " gen [--seed=S] [--count=N] [--cells=N]"
+          " [--playout=<moves>] [--solvable] [--budget=<boards>]\n"
+          "             [--format=text|binary] [--layout=rows|columns]"
+          " [--out=<dir or file>]\n" << endl;
   cout << "Game file should look something like this:" << endl;
   cout << kSampleGame << endl << endl;
   cout << "Note that the colons are optional, but the game data isn't.\n"
@@ -1051,51 +6514,219 @@ int usage(int status, const char* prg) {
   return status;
 }
 
+#ifndef FREECELL_LIBRARY
 int main(int argc, char* argv[]) {
   if (argc < 2) {
     return usage(0, *argv);
   }
+  if (string(argv[1]) == "verify") {
+    if (argc < 4) return usage(1, *argv);
+    Board::Layout layout = Board::ROWS;
+    card_count_t cells = RESERVE_SIZE;
+    for (int i = 4; i < argc; ++i) {
+      string arg, val;
+      if (!parse_flag(argv[i], &arg, &val)
+          || !((arg == "layout" && parse_layout(val, &layout))
+               || (arg == "cells" && parse_cells(val, &cells)))) {
+        return usage(1, *argv);
+      }
+    }
+    return verify_main(argv[2], argv[3], layout, cells);
+  }
+  if (string(argv[1]) == "sweep") return sweep_main(argc - 1, argv + 1);
+  if (string(argv[1]) == "gen") return gen_main(argc - 1, argv + 1);
+  if (string(argv[1]) == "hint") return hint_main(argc - 1, argv + 1);
+  if (string(argv[1]) == "scale") return scale_main(argc - 1, argv + 1);
+  if (string(argv[1]) == "bench-compare") {
+    return bench_compare_main(argc - 1, argv + 1);
+  }
+  if (string(argv[1]) == "trace-report") {
+    if (argc != 3) return usage(1, *argv);
+    return trace_report(argv[2]);
+  }
   
   string fname;
   bool interactive = false;
   bool print_boards = false;
+  bool timings_requested = false;
+  bool stats_requested = false;
+  bool perf_requested = false;
+  bool verify_requested = false;
+  bool pipeline = false;
+  unsigned pipeline_jobs = SolveOptions().pipeline_jobs;
+  unsigned pipeline_boards = SolveOptions().pipeline_boards;
+  bool ida = false;
+  bool affinity = false;
+  bool deterministic = false;
+  size_t beam_width = 0;
+  unsigned threads = 1;
+  card_count_t cells = RESERVE_SIZE;
+  SolutionFormatter::Style format = SolutionFormatter::HUMAN;
+  Board::Layout layout = Board::ROWS;
+  string json_fname;
+  string trace_fname;
+  string chrome_fname;
   
   for (int i = 1; i < argc; ++i) {
-    if (argv[i][0] == '-') {
-      string arg = argv[i] + 1 + (argv[i][1] == '-');
+    string arg, val;
+    if (parse_flag(argv[i], &arg, &val)) {
       if (arg == "interactive") { interactive = true; continue; }
       if (arg == "print_boards") { print_boards = true; continue; }
+      if (arg == "timings") { timings_requested = true; continue; }
+      if (arg == "stats") { stats_requested = true; continue; }
+      if (arg == "perf") { perf_requested = true; continue; }
+      if (arg == "verify") { verify_requested = true; continue; }
+      if (arg == "pipeline") { pipeline = true; continue; }
+      if (arg == "pipeline-window" && atoi(val.c_str()) > 0) {
+        pipeline_jobs = atoi(val.c_str());
+        continue;
+      }
+      if (arg == "pipeline-batch" && atoi(val.c_str()) > 0) {
+        pipeline_boards = atoi(val.c_str());
+        continue;
+      }
+      if (arg == "ida") { ida = true; continue; }
+      if (arg == "affinity") { affinity = true; continue; }
+      if (arg == "deterministic") { deterministic = true; continue; }
+      if (arg == "json" && !val.empty()) { json_fname = val; continue; }
+      if (arg == "trace" && !val.empty()) { trace_fname = val; continue; }
+      if (arg == "chrome-trace" && !val.empty()) {
+        chrome_fname = val;
+        continue;
+      }
+      if (arg == "sanity" && parse_sanity(val, &sanity_interval)) continue;
+      if (arg == "cells" && parse_cells(val, &cells)) continue;
+      if (arg == "format" && SolutionFormatter::parse_style(val, &format)) {
+        continue;
+      }
+      if (arg == "layout" && parse_layout(val, &layout)) continue;
+      if (arg == "beam" && atoi(val.c_str()) > 0) {
+        beam_width = atoi(val.c_str());
+        continue;
+      }
+      if (arg == "threads" && atoi(val.c_str()) > 0) {
+        threads = atoi(val.c_str());
+        continue;
+      }
       cerr << "Unknown flag `" << argv[i] << "'" << endl;
       return usage(1, *argv);
     } else {
       if (fname.empty()) fname = argv[i];
     }
   }
+  if (affinity && !ida) {
+    cerr << "--affinity only applies to --ida." << endl;
+    return usage(1, *argv);
+  }
   
-  cout << "Parsing board from \"" << fname << "\"..." << endl;
-  std::ifstream game_file(fname);
-  if (!game_file) {
-    cerr << "Failed to open input file." << endl;
-    return 2;
+  if (!chrome_fname.empty()) {
+    chrome_trace = new ChromeTrace;
+    chrome_trace->name_thread("main");
+  }
+  
+  // Binary solutions go to stdout alone; the commentary moves aside.
+  std::ostream &log = format == SolutionFormatter::BINARY ? cerr : cout;
+  
+  PhaseTimings timings;
+  string game_desc;
+  Board game;
+  /* Parse phase. */ {
+    PhaseTimer timer(&timings, PhaseTimings::PARSE);
+    log << "Parsing board from \"" << fname << "\"..." << endl;
+    if (!read_file(fname, &game_desc)) {
+      cerr << "Failed to open input file." << endl;
+      return 2;
+    }
+    string error;
+    game.cells = cells;
+    if (!game.parse(game_desc, &error, layout)) {
+      cerr << "Invalid board: " << error << "." << endl;
+      return 1;
+    }
   }
-  string game_desc { std::istreambuf_iterator<char>(game_file),
-                     std::istreambuf_iterator<char>() };
-  cout << "Read the following game descriptor:" << endl << game_desc;
   
-  FluffyBoard parsed_game { game_desc };
-  cout << "Evaluates as the following board:" << endl << parsed_game.str()
+  FluffyBoard parsed_game;
+  /* Construction phase. */ {
+    PhaseTimer timer(&timings, PhaseTimings::CONSTRUCT);
+    parsed_game = game.inflate();
+  }
+  log << "Read the following game descriptor:" << endl << game_desc;
+  log << "Evaluates as the following board:" << endl << parsed_game.str()
        << endl << endl;
   
-  MoveList winning_moves = solve(Board { parsed_game });
+# ifdef SIGUSR1
+    std::signal(SIGUSR1, request_search_dump);
+# endif
   
-  if (!interactive || !kUseCurses) {
-    for (const MoveDescription &move : winning_moves) {
-      if (interactive || print_boards) {
-        cout << (interactive ? "\n" : "\n\n")
-             << move.result.str()
-             << endl;
-      }
-      cout << move.action << endl;
+  std::unique_ptr<TraceWriter> trace;
+  if (!trace_fname.empty()) {
+    trace.reset(new TraceWriter(trace_fname));
+    if (!trace->good()) {
+      cerr << "Failed to open trace file \"" << trace_fname << "\"." << endl;
+      return 2;
+    }
+    search_trace = trace.get();
+  }
+  
+  std::unique_ptr<PerfCounters> perf;
+  if (perf_requested) {
+    perf.reset(new PerfCounters);
+    if (!perf->available()) {
+      cerr << "Hardware counters unavailable (" << perf->error
+           << "); continuing without them." << endl;
+    }
+    search_perf = perf.get();
+  }
+  
+  SolveOptions options;
+  options.report_memory = stats_requested;
+  options.verbose = format != SolutionFormatter::BINARY;
+  options.beam_width = beam_width;
+  options.pipeline = pipeline;
+  options.pipeline_jobs = pipeline_jobs;
+  options.pipeline_boards = pipeline_boards;
+  options.ida = ida;
+  options.affinity = affinity;
+  options.deterministic = deterministic;
+  options.threads = threads;
+  SearchStats stats;
+  MoveList winning_moves = solve(game, options, &timings, &stats);
+  search_perf = nullptr;
+  
+  if (trace) {
+    search_trace = nullptr;
+    const size_t records = trace->records;
+    trace.reset();
+    log << "Wrote " << records << " trace records to \"" << trace_fname
+         << "\"." << endl;
+  }
+  
+  if (verify_requested && !winning_moves.empty()) {
+    VerifyResult result = verify_solution(parsed_game, winning_moves.moves);
+    if (!result.valid) {
+      cerr << "Solution failed verification! " << result.error << "." << endl;
+      return 3;
+    }
+    log << "Solution verified." << endl;
+  }
+  
+  const Clock::time_point output_start = Clock::now();
+  if (!interactive && !print_boards) {
+    SolutionFormatter formatter;
+    if (!formatter.format(winning_moves, format)) {
+      cerr << "Solution does not replay from the starting board." << endl;
+      return 3;
+    }
+    formatter.write(cout);
+    if (format != SolutionFormatter::BINARY) {
+      cout << "Game complete (" << winning_moves.size() << " moves)" << endl;
+    }
+  } else if (!interactive || !kUseCurses) {
+    for (MoveList::Replay replay(winning_moves); replay.next(); ) {
+      cout << (interactive ? "\n" : "\n\n")
+           << replay.current().inflate().str()
+           << endl;
+      cout << replay.last().str() << endl;
       if (interactive) std::cin.get();
     }
     if (!interactive) {
@@ -1113,25 +6744,25 @@ int main(int argc, char* argv[]) {
       curs_set(FALSE);
       
       int boardwidth = 8 + 7 + 8, boardheight = 0, textwidth = 0;
-      for (const MoveDescription &move : winning_moves) {
+      for (MoveList::Replay replay(winning_moves); replay.next(); ) {
         int hgt = 0;
-        for (const FluffyCascade &c : move.result.cascades) {
-          hgt = std::max(hgt, (int) c.size());
+        for (card_count_t c = 0; c < CASCADE_COUNT; ++c) {
+          hgt = std::max(hgt, (int) replay.current().cascade_size(c));
         }
         boardheight = std::max(hgt, boardheight );
-        boardwidth  = std::max((int) move.result.cascades.size(), boardwidth);
-        textwidth   = std::max((int) move.action.length(), textwidth);
+        boardwidth  = std::max((int) CASCADE_COUNT, boardwidth);
+        textwidth   = std::max((int) replay.last().str().length(), textwidth);
       }
       boardheight += 2;
       
-      for (auto at = winning_moves.begin(); ; ) {
+      for (size_t at = 0; ; ) {
         clear();
-        if (at == winning_moves.end()) {
+        if (at == winning_moves.size()) {
           string inst = "Press 'Q' to quit.";
           mvaddstr(boardheight + 2, (COLS - inst.length()) / 2, inst.c_str());
         } else {
-          const MoveDescription& move = *at;
-          string board_str = move.result.str();
+          const Move &move = winning_moves.moves[at];
+          string board_str = winning_moves.board_after(at + 1).inflate().str();
           std::basic_string<unsigned int> w(board_str.begin(), board_str.end());
           
           int pcs = 0;
@@ -1142,16 +6773,16 @@ int main(int argc, char* argv[]) {
             ++pcs;
             if (nl == string::npos) break;
           }
-          string inst = move.action;
+          string inst = move.str();
           mvaddstr(boardheight + 2, (COLS - inst.length()) / 2, inst.c_str());
         }
         
         int c = getch();
         if (c == KEY_UP || c == KEY_LEFT || c == KEY_BACKSPACE) {
-          if (at != winning_moves.begin()) at--;
+          if (at) at--;
         }
         else if (c == KEY_DOWN || c == KEY_RIGHT || c == KEY_ENTER || c == ' ') {
-          if (at != winning_moves.end()) at++;
+          if (at != winning_moves.size()) at++;
         }
         else if (c == 'Q' || c == 'q') break;
       }
@@ -1159,9 +6790,37 @@ int main(int argc, char* argv[]) {
 #   endif
   }
   
+  timings.add(PhaseTimings::OUTPUT, output_start);
+  if (chrome_trace) {
+    chrome_trace->complete("output", "phase", output_start, Clock::now());
+  }
+  
+  if (chrome_trace && !write_chrome_trace(chrome_fname, log)) return 2;
+  if (timings_requested) log << timings.str();
+  if (stats_requested) log << stats.str();
+  if (perf) log << perf->str(stats.expanded);
+  if (!json_fname.empty()) {
+    std::ofstream json(json_fname);
+    if (!json) {
+      cerr << "Failed to open JSON output file \"" << json_fname << "\"." << endl;
+    } else {
+      json << "{\n"
+           << "  \"game\": " << json_string(fname) << ",\n"
+           << "  \"solved\": " << (winning_moves.empty() ? "false" : "true")
+           << ",\n"
+           << "  \"moves\": " << winning_moves.size() << ",\n"
+           << "  \"timings\": " << timings.json() << ",\n"
+           << "  \"stats\": " << stats.json();
+      if (perf) json << ",\n  \"perf\": " << perf->json(stats.expanded);
+      json << "\n"
+           << "}\n";
+    }
+  }
+  
   if (winning_moves.empty()) {
     cerr << "Solution could not be found." << endl;
     return 1;
   }
   return 0;
 }
+#endif  // FREECELL_LIBRARY
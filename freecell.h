@@ -0,0 +1,93 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// The solver's C interface, for embedding it in other programs. Build the
+// library with -DFREECELL_LIBRARY, which leaves out the command line program.
+//
+// Boards go in packed, as `freecell gen --format=binary` writes them (less the
+// file header): the four reserve cards, the height of each foundation (spades,
+// hearts, diamonds, clubs), then the 60-byte card bank, each cascade's cards
+// from the one buried deepest, with a 0 after each cascade. A card is
+// face << 2 | suit, with faces counting 1 (ace) to 13 (king), suits in the
+// order above, and 0 for no card.
+//
+// A solver keeps its memory from one call to the next: once it has solved a
+// deal as hard as the ones it is given, fc_solve() doesn't allocate at all.
+// A solver may be used by one thread at a time; use one solver per thread.
+
+#ifndef FREECELL_H
+#define FREECELL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FC_BOARD_BYTES 68
+
+/// fc_solve() found no solution: every reachable board was searched.
+#define FC_UNSOLVABLE (-1)
+/// fc_solve() gave up after spending its whole budget.
+#define FC_BUDGET_EXCEEDED (-2)
+/// The board bytes don't hold exactly one deck of cards, or hold a byte that
+/// is neither 0 nor a card as encoded above; or the options ask for more than
+/// four free cells, or for fewer than the board already fills.
+#define FC_INVALID_BOARD (-3)
+
+/// Places a move can name in place of a card.
+#define FC_CASCADE (-3)     ///< An empty cascade.
+#define FC_RESERVE (-2)     ///< An empty reserve.
+#define FC_FOUNDATION (-1)  ///< The foundation.
+
+/// One move, as three bytes. `source` is the card moved (for a run of cards,
+/// the one on top, at the end of its cascade); `dest` is the card it is moved
+/// onto, or one of the places above.
+typedef struct fc_move {
+  int8_t source;
+  int8_t dest;
+  uint8_t count;
+} fc_move;
+
+/// Limits on one search. Zero means no limit.
+typedef struct fc_options {
+  uint64_t max_expansions;  ///< Give up after expanding this many boards.
+  double max_seconds;       ///< Give up after searching this long.
+  uint64_t max_bytes;       ///< Give up once the search holds this much.
+  uint32_t cells;           ///< Free cells in play, for the one-, two- and
+                            ///< three-cell games; 0 (or 4) plays with all 4.
+} fc_options;
+
+typedef struct fc_solver fc_solver;
+
+/// Creates a solver, or returns NULL if out of memory.
+fc_solver *fc_solver_new(void);
+
+/// Solves a packed board, writing up to `out_cap` moves to `out_moves`.
+/// Returns the length of the solution, which, if it is more than `out_cap`,
+/// means only the first `out_cap` moves were written; or a negative FC_ code.
+/// `options` may be NULL for an unlimited search.
+int fc_solve(fc_solver *solver, const uint8_t *board_bytes,
+             const fc_options *options, fc_move *out_moves, size_t out_cap);
+
+/// Bytes the solver is holding on to between calls.
+size_t fc_solver_memory(const fc_solver *solver);
+
+void fc_solver_free(fc_solver *solver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FREECELL_H